@@ -0,0 +1,31 @@
+#pragma once
+#include <Arduino.h>
+#include <Ethernet.h>
+#include "config.h"
+
+// Bridge entry for a unit ID, nullptr if the unit sits on the local bus.
+const BridgeEndpoint *bridgeFor(uint8_t id);
+
+// Reply timeout for reads through the bridge of unit id; for UDP bridges
+// this is the retransmit timeout of one try.
+uint16_t bridgeTimeoutMs(uint8_t id);
+
+// One FC3 read through a bridge; regs receives qty words. timeoutMs
+// bounds the TCP connect as well as the reply. reached (optional) tells
+// whether the bridge accepted the TCP connection or, over UDP, answered
+// at all.
+bool bridgeReadRegs(const BridgeEndpoint &b, uint16_t addr, uint16_t qty,
+                    uint16_t *regs, uint16_t timeoutMs,
+                    bool *reached = nullptr);
+
+// Reads every span with the fewest requests the planner allows; out
+// receives the spans packed back to back in table order. Modbus TCP
+// bridges get all requests in one burst, the others one at a time.
+bool bridgeReadSpans(const BridgeEndpoint &b, const RegSpan *spans,
+                     uint8_t n, uint16_t *out, uint16_t timeoutMs);
+
+// One FC3 read through an RTU-over-TCP bridge; regs receives qty words.
+// reached (optional) tells whether the TCP connect itself succeeded.
+bool rtuOverTcpReadRegs(uint16_t *regs, const IPAddress &ip, uint16_t port,
+                        uint8_t unit, uint16_t addr, uint16_t qty,
+                        uint16_t timeoutMs, bool *reached = nullptr);
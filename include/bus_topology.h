@@ -0,0 +1,33 @@
+#pragma once
+#include "config.h"
+
+// Devices found by the last discovery scan, indexed by unit ID.
+struct BusTopology {
+  DeviceProfile profile[MAX_DEVICE_ID + 1];
+  uint16_t bridged; // bit per ID reached over a TCP bridge
+};
+
+extern BusTopology bus_topology;
+
+// EEPROM copy; load fails on a missing record or CRC mismatch.
+bool topologyLoad();
+void topologySave();
+
+// Starts a scan of Serial3 and the known bridges without blocking: RTU
+// reads are chained from their replies, bridges take one read per
+// topologyService(). The result replaces the topology and is saved.
+void topologyDiscover();
+// Schedules a scan for the next monitoring tick.
+void topologyRequestDiscovery();
+// Marks one unit absent so the background probe classifies it again.
+void topologyForget(uint8_t id);
+// Once per monitoring cycle: starts a requested scan or drops vanished
+// devices, then advances the scan or background probe by one read and
+// saves background changes once they have settled.
+void topologyService();
+
+bool topologyHas(uint8_t id);
+bool topologyIsBridged(uint8_t id);
+// Register block to poll for a discovered device, nullptr if none.
+const RegSpan *topologyBlock(uint8_t id);
+void topologyLog();
@@ -0,0 +1,22 @@
+#pragma once
+#include "config.h"
+
+// Runtime channel map (word layout in config.h): starts from
+// DEFAULT_CHANNEL_MAP, is rewritten over Modbus and kept in EEPROM.
+
+// EEPROM copy if valid, the defaults otherwise.
+void channelMapLoad();
+void channelMapSave();
+
+// Range check of a word for unit id: known profile, channels that exist
+// and are polled, a pinned profile reachable over the unit's transport.
+bool channelMapValid(uint8_t id, uint16_t word);
+// Applies a word checked by channelMapValid(); a new pinned profile sends
+// the unit back to discovery.
+void channelMapSet(uint8_t id, uint16_t word);
+
+uint16_t channelMapWordOf(uint8_t id);
+DeviceProfile channelMapProfile(uint8_t id);
+// ChannelIndex fed by value k of the unit, MAP_NO_CHANNEL if none.
+uint8_t channelMapChannel(uint8_t id, uint8_t k);
+bool channelMapAny(uint8_t id);
@@ -28,18 +28,43 @@ extern const char VERSION[];
 
 // --------- Globals mass --------------
 extern double send_arr[];
-extern float sensors_dec[];
-extern float radiation_uSvh;
-extern float service_t[];
-
-extern const size_t sensors_dec_cnt;
-extern const size_t service_t_cnt;
+// Latest sample per ChannelIndex in 1/channelScale() units
+extern int32_t channel_fx[];
+
+// Bit per ChannelIndex, set while no device delivered the channel this cycle
+extern uint16_t stale_channels;
+// stale_channels of the cycle collectAndAverageEveryMinute() last sampled;
+// the poll queued right after it marks every polled channel stale again
+extern uint16_t cycle_stale_channels;
 // ---------- Value Timers -------------
 constexpr uint32_t MONITOR_TIME_SLEEP = 1 * SEC;
 constexpr uint32_t BDBG_TIME_SLEEP  = 30 * SEC;
 constexpr uint32_t DRAW_TIME_SLEEP  = 1 * MIN;
 constexpr uint32_t RELAY_TIME_SLEEP  = 10 * MIN;
-constexpr uint32_t SEND_DATA_TIME_SLEEP  = 1 * MIN;
+constexpr uint32_t UPLOAD_RETRY_SLEEP  = 1 * MIN;
+
+// ---------- Runtime settings ----------
+// Writable over Modbus (FC6/FC16) as holding registers from
+// HR_SETTINGS_ADDR; the *_SLEEP values above are the boot defaults.
+// Kept in RAM only.
+enum StationSetting : uint8_t {
+  SET_MONITOR_MS,     // polling period, ms; must divide the 60 s minute
+  SET_BDBG_S,         // radiation request period, s
+  SET_UPLOAD_RETRY_S, // wait after a failed upload, s; the backlog goes
+                      // out back to back while posts succeed
+  SETTINGS_COUNT
+};
+
+struct SettingLimits {
+  uint16_t min;
+  uint16_t max;
+};
+
+constexpr uint16_t HR_SETTINGS_ADDR = 1000;
+// Channel map words (channel_map.h), one holding register per unit ID
+constexpr uint16_t HR_CHANNEL_MAP_ADDR = 1100;
+extern uint16_t station_settings[SETTINGS_COUNT];
+extern const SettingLimits SETTING_LIMITS[SETTINGS_COUNT];
 
 // ---------- Pins ----------
 constexpr uint8_t RS485_DIR_PIN = 5; // DE/RE for RS-485 (Sensor Box)
@@ -51,27 +76,33 @@ constexpr uint32_t SERIAL0_BAUD = 115200; // USB debug
 constexpr uint32_t SERIAL2_BAUD = 19200;  // BDBG-09, 8N1
 constexpr uint32_t SERIAL3_BAUD = 9600;   // Sensor Box
 
+// 3.5 character times of line silence between frames. Modbus RTU fixes
+// it at 1750 us above 19200 baud.
+constexpr uint16_t frameGapUs(uint32_t baud, uint8_t bitsPerChar) {
+  return baud > 19200 ? 1750 : (uint16_t)((35UL * bitsPerChar * 100000UL) / baud);
+}
+
 // ---------- BDBG-09 UART Timings ----------
 constexpr uint32_t BDBG_FIRST_BYTE_TIMEOUT_MS = 500;
 constexpr uint32_t BDBG_INTERBYTE_TIMEOUT_MS = 50;
+constexpr uint16_t BDBG_FRAME_GAP_US = frameGapUs(SERIAL2_BAUD, 10); // 8N1
+
+// ---------- RS-485 transaction queue (Serial3) ----------
+// Buffers are sized for the largest transaction actually issued: FC1/3/5
+// requests and FC3 reads of up to RS485_MAX_READ_REGS registers.
+constexpr uint8_t RS485_QUEUE_LEN = 8;
+constexpr uint8_t RS485_MAX_READ_REGS = 8;
+constexpr uint8_t RS485_MAX_REQ = 8; // request ADU incl. CRC
+constexpr uint8_t RS485_MAX_RESP = 5 + 2 * RS485_MAX_READ_REGS; // incl. CRC
+constexpr uint16_t RS485_FRAME_GAP_US = frameGapUs(SERIAL3_BAUD, 10); // 8N1
 
 // ---------- Sensor Box (Modbus RTU) ----------
 extern bool active_ids[6];
 
-// Primary/extra device IDs
+// Primary box IDs (shown on the display when discovered)
 extern const uint8_t PRIMARY_IDS[];
 extern const uint8_t PRIMARY_COUNT;
 
-extern const uint8_t EXTRA_IF_ONLY2[];
-extern const uint8_t EXTRA_IF_ONLY4[];
-extern const uint8_t EXTRA_IF_ONLY6[];
-extern const uint8_t EXTRA_IF_ONLY7[];
-
-extern const uint8_t EXTRA_ONLY2_CNT;
-extern const uint8_t EXTRA_ONLY4_CNT;
-extern const uint8_t EXTRA_ONLY6_CNT;
-extern const uint8_t EXTRA_ONLY7_CNT;
-
 // Remote bridge (ID 4)
 extern const IPAddress ip_3;
 extern const IPAddress ip_4;
@@ -81,6 +112,66 @@ extern const IPAddress ip_9;
 constexpr int port = 5581;
 constexpr uint8_t time_sleep = 20;
 
+// Modbus TCP bridges: persistent sockets kept open (W5500 has 8 in total)
+// and requests written per burst before the first reply is awaited.
+constexpr uint16_t MBTCP_PORT = 502;
+constexpr uint8_t MBTCP_MAX_SESSIONS = 2;
+constexpr uint8_t MBTCP_MAX_INFLIGHT = 4;
+
+// UDP bridges: one shared local socket; the per-try retransmit timeout
+// adapts within BRIDGE_UDP_TIMEOUTS, BRIDGE_UDP_RETRIES resends follow.
+constexpr uint16_t BRIDGE_UDP_LOCAL_PORT = 5582;
+constexpr uint8_t BRIDGE_UDP_RETRIES = 2;
+
+// ---------- Adaptive Modbus timeouts ----------
+// Timeout = SRTT + 4 * RTTVAR per device, doubled on each miss, clamped.
+struct TimeoutLimits {
+  uint16_t initialMs; // used until the first reply is measured
+  uint16_t minMs;
+  uint16_t maxMs;
+};
+
+constexpr uint8_t MAX_DEVICE_ID = 15;
+constexpr uint8_t RTT_MAX_BACKOFF = 4;
+constexpr TimeoutLimits RTU_TIMEOUTS = {150, 40, 500};
+constexpr TimeoutLimits BRIDGE_TIMEOUTS = {time_sleep, 20, 1000};
+constexpr TimeoutLimits BRIDGE_UDP_TIMEOUTS = {60, 20, 300};
+constexpr TimeoutLimits RELAY_TIMEOUTS = {500, 60, 500};
+
+// ---------- Dead-device circuit breaker ----------
+// After BREAKER_OPEN_AFTER failed polls in a row a device is skipped and
+// re-probed with one trial read per backoff interval (doubling each miss).
+constexpr uint8_t BREAKER_OPEN_AFTER = 3;
+constexpr uint32_t BREAKER_BACKOFF_MIN = 4 * SEC;
+constexpr uint32_t BREAKER_BACKOFF_MAX = 2 * MIN;
+
+// ---------- Register-range coalescing ----------
+struct RegSpan {
+  uint16_t addr;
+  uint16_t qty;
+};
+
+struct DeviceReadLimit {
+  uint8_t id;
+  uint16_t maxRegs; // max registers in one FC3 read for this device
+};
+
+// Unused registers worth reading to save one more round trip
+constexpr uint16_t MB_COALESCE_MAX_GAP = 16;
+// Default per-read limit; a bridged reply must fit one frame slot
+constexpr uint16_t MB_MAX_READ_REGS = 32;
+
+extern const DeviceReadLimit READ_LIMITS[];
+extern const uint8_t READ_LIMITS_CNT;
+
+// PROFILE_BRIDGE_GAS_SPLIT registers: three float32, sorted by address
+extern const RegSpan BRIDGE_SPLIT_SPANS[];
+extern const uint8_t BRIDGE_SPLIT_SPANS_CNT;
+constexpr uint16_t BRIDGE_GAS_ADDR = 0x0032; // first float32 of bridged gas
+
+// Temperature / RH sensor
+constexpr uint8_t TEMP_RH_ID = 11;
+
 // PM sensor map
 constexpr uint8_t PM_ID = 10;
 constexpr uint8_t PM_START_ADDR = 1;
@@ -97,28 +188,154 @@ constexpr uint16_t GAS_REG_COUNT2 = 6;
 constexpr int co_divider = 100;
 constexpr int so2_no2_divider = 1000;
 constexpr int divider = 100;
+constexpr int divider_t_rh = 10; // TEMP_RH_ID: T and RH in 0.1 units
+
+// ---------- Bus discovery ----------
+// Register maps recognised by the discovery scan. A profile says how to
+// read and decode a device; which channel each value feeds comes from the
+// channel map.
+enum DeviceProfile : uint8_t {
+  PROFILE_NONE,       // nothing answered
+  PROFILE_UNKNOWN,    // answered, register map not recognised or ambiguous
+  PROFILE_GAS_F32,    // 3 x float32 from GAS_START_ADDR (IDs 5/6/7)
+  PROFILE_GAS_U16,    // scaled integers from GAS_START_ADDR2 (ID 2)
+  PROFILE_PM,         // PM2.5/PM10 from PM_START_ADDR (ID 10)
+  PROFILE_TEMP_RH,    // RH, T from 0x0000 (ID 11)
+  PROFILE_BRIDGE_GAS, // float32 from BRIDGE_GAS_ADDR behind a TCP bridge
+  PROFILE_BRIDGE_PM,  // PM counts from 0x0000 behind a TCP bridge
+  PROFILE_BRIDGE_GAS_SPLIT, // float32 at BRIDGE_SPLIT_SPANS (ID 8)
+  PROFILE_COUNT
+};
+
+constexpr bool profileIsBridged(DeviceProfile p) {
+  return p == PROFILE_BRIDGE_GAS || p == PROFILE_BRIDGE_PM ||
+         p == PROFILE_BRIDGE_GAS_SPLIT;
+}
+// Values a profile decodes from its poll block
+constexpr uint8_t profileValues(DeviceProfile p) {
+  return (p == PROFILE_PM || p == PROFILE_TEMP_RH || p == PROFILE_BRIDGE_PM)
+             ? 2
+         : p > PROFILE_UNKNOWN ? 3
+                               : 0;
+}
+
+struct ProfileProbe {
+  DeviceProfile profile;
+  RegSpan block; // registers polled for this profile
+};
+
+// How a bridge carries FC3 reads: raw RTU frames, one request per
+// connection, or native Modbus TCP with MBAP transaction IDs, where the
+// socket stays open and several requests may be outstanding at once.
+// The UDP variants send one datagram each way per read, retransmitted
+// on loss.
+enum BridgeTransport : uint8_t {
+  BRIDGE_RTU_TCP,
+  BRIDGE_MODBUS_TCP,
+  BRIDGE_RTU_UDP,    // RTU frame with CRC, matched by unit/FC/length
+  BRIDGE_MODBUS_UDP, // MBAP header, matched by transaction ID
+};
+
+struct BridgeEndpoint {
+  uint8_t id; // unit ID behind the bridge
+  const IPAddress &ip;
+  BridgeTransport transport;
+  uint16_t port;
+};
+
+// Serial3 unit IDs probed by the scan (the relay UNIT_ID is skipped)
+constexpr uint8_t DISCOVERY_ID_FIRST = 1;
+constexpr uint8_t DISCOVERY_ID_LAST = MAX_DEVICE_ID;
+// Background re-discovery: one probe read of one absent ID per monitoring
+// cycle; a device left open by the breaker for TOPOLOGY_DROP_AFTER failed
+// polls is dropped and goes back to the absent set. Such changes reach
+// EEPROM once the topology has not changed for TOPOLOGY_SAVE_SETTLE_MS.
+constexpr TimeoutLimits PROBE_TIMEOUTS = {100, 40, 150};
+constexpr uint8_t TOPOLOGY_DROP_AFTER = 8;
+constexpr uint32_t TOPOLOGY_SAVE_SETTLE_MS = 15 * MIN;
+
+extern const ProfileProbe RTU_PROBES[];
+extern const uint8_t RTU_PROBES_CNT;
+extern const ProfileProbe BRIDGE_PROBES[];
+extern const uint8_t BRIDGE_PROBES_CNT;
+extern const BridgeEndpoint BRIDGES[];
+extern const uint8_t BRIDGES_CNT;
+
+// ---------- Channel map ----------
+// Per unit ID one 16-bit word (holding register HR_CHANNEL_MAP_ADDR + id):
+//   bits 12..15  profile the unit is known to have, PROFILE_NONE = detect
+//   bits 0..11   ChannelIndex fed by value 0, 1 and 2 of the profile
+//                (4 bits each, MAP_NO_CHANNEL = value not used)
+// A unit without mapped values is discovered but not polled.
+constexpr uint8_t MAP_VALUES = 3;
+constexpr uint8_t MAP_NO_CHANNEL = 0x0F;
+
+constexpr uint16_t channelMapWord(DeviceProfile p, uint8_t v0 = MAP_NO_CHANNEL,
+                                  uint8_t v1 = MAP_NO_CHANNEL,
+                                  uint8_t v2 = MAP_NO_CHANNEL) {
+  return ((uint16_t)p << 12) | ((uint16_t)v2 << 8) | ((uint16_t)v1 << 4) | v0;
+}
+
+struct ChannelMapDefault {
+  uint8_t id;
+  uint16_t word;
+};
+
+// Stock wiring, used until a map is written over Modbus
+extern const ChannelMapDefault DEFAULT_CHANNEL_MAP[];
+extern const uint8_t DEFAULT_CHANNEL_MAP_CNT;
+
+// ---------- EEPROM layout ----------
+// 0..5: MAC address (see eth_manager)
+constexpr int EEPROM_TOPOLOGY_ADDR = 16;
+constexpr int EEPROM_CHANNEL_MAP_ADDR = 40;
+// 16..95: fixed records. Minute log ring (minute_log) from here to the
+// end of the 4 KB EEPROM
+constexpr int EEPROM_LOG_ADDR = 96;
+constexpr int EEPROM_LOG_END = 4096;
 
 // ---------- Ethernet / Modbus TCP ----------
 // Local TCP server
 constexpr uint16_t MODBUS_TCP_PORT = 502;
 constexpr uint16_t SERIAL_TCP_PORT = 503;
 constexpr uint16_t RELAY_HTTP_PORT = 504;
+// Concurrent Modbus TCP masters; each holds a W5500 socket, so keep this
+// within what the bridges, uploads and the 503/504 servers leave free.
+constexpr uint8_t MB_MAX_CLIENTS = 2;
+constexpr uint32_t MB_CLIENT_IDLE_MS = 60000; // silent master is dropped
+constexpr uint8_t MB_CLIENT_RX_BUF = 64;      // bytes of one request
+
+// Gateway: Modbus TCP requests for these Serial3 unit IDs (when present in
+// the bus topology) are forwarded over RS-485; any other unit ID is the
+// station itself and is served from send_arr. One forwarded request at a
+// time, started no sooner than GATEWAY_MIN_GAP_MS after the previous one
+// and dropped if the bus stays busy for GATEWAY_QUEUE_MS.
+constexpr uint16_t GATEWAY_UNITS = (1u << 2) | (1u << 5) | (1u << 6) |
+                                   (1u << 7) | (1u << 10) | (1u << 11);
+constexpr uint16_t GATEWAY_MIN_GAP_MS = 100;
+constexpr uint16_t GATEWAY_QUEUE_MS = 1000;
 
 extern const byte MAC_ADDR[];
 extern const IPAddress STATIC_IP;
 extern const IPAddress GETWAY;
 
-extern uint8_t resp[256];
-
 // Remote Server
 extern const char SERVER_IP[]; // рядок як масив символів
 constexpr uint16_t server_port = 4000;
 extern const char API_KEY[];
 
+// ---------- Frame buffer pool ----------
+// Slot fits one Modbus TCP ADU; the sensors upload leases HTTP_BODY_SLOTS
+// adjacent slots. Paths that run one after another in loop() share them.
+constexpr uint16_t FRAME_SLOT_SIZE = 260;
+constexpr uint8_t FRAME_POOL_SLOTS = 3;
+constexpr uint8_t HTTP_BODY_SLOTS = 3;
+
 // ---------- Relay ----------
 constexpr uint16_t NET_CHECK_PORT = 53;
 
 constexpr uint8_t UNIT_ID = 12; // ID пристрою
+constexpr uint8_t RELAY_CHANNELS = 4; // writable coils 0..3, 8 readable
 constexpr uint8_t CH = 0;       // Канал взаємодії від 0-3
 constexpr uint32_t RELAY_PULSE_MS = 2 * MIN;
 
@@ -150,6 +367,37 @@ enum ChannelIndex : uint8_t {
 };
 constexpr size_t CH_COUNT = CH_TOTAL_COUNT;
 
+constexpr uint16_t chBit(ChannelIndex ch) { return (uint16_t)1 << ch; }
+// Channels filled by polled devices (radiation comes from BDBG)
+constexpr uint16_t POLLED_CHANNELS =
+    ((uint16_t)1 << CH_COUNT) - 1 - chBit(CH_R);
+
+// ---------- Fixed-point channels ----------
+// Channel values travel as integers in 1/scale of the channel's unit from
+// decode to send_arr; float is only used where a device sends IEEE-754.
+// Scales are multiples of the device dividers above so that raw registers
+// convert with one integer multiply.
+constexpr int32_t channelScale(ChannelIndex ch) {
+  return (ch == CH_R || ch == CH_S_T || ch == CH_S_RH) ? 100
+         : (ch == CH_PM2_5 || ch == CH_PM10)           ? 1000
+                                                       : 10000;
+}
+constexpr float channelStep(ChannelIndex ch) {
+  return (ch == CH_R || ch == CH_S_T || ch == CH_S_RH) ? 0.01f
+         : (ch == CH_PM2_5 || ch == CH_PM10)           ? 0.001f
+                                                       : 0.0001f;
+}
+
+// ---------- Rollups ----------
+// History kept in SRAM per level, newest first. Hourly records are merged
+// from the last four quarter-hour records, so that ring needs 4 slots.
+// A record is 136 B and the open quarter 286 B, about 1650 B in all.
+// Check the margin against sramLowWater() before raising the budget.
+constexpr uint8_t ROLLUP_MINUTE_SLOTS = 3;
+constexpr uint8_t ROLLUP_QUARTER_SLOTS = 4;
+constexpr uint8_t ROLLUP_HOUR_SLOTS = 3;
+constexpr uint16_t ROLLUP_RAM_BUDGET = 1800; // bytes, rings + open quarter
+
 struct LabelEntry {
   const char *name;
   ChannelIndex channel;
@@ -0,0 +1,27 @@
+#pragma once
+#include "config.h"
+
+enum DeviceState : uint8_t {
+  DEV_HEALTHY, // answered the last poll
+  DEV_SUSPECT, // recent failures, still polled every cycle
+  DEV_OPEN,    // skipped; one trial read per backoff interval
+};
+
+struct DeviceHealthStats {
+  DeviceState state;
+  uint8_t failures;  // consecutive failed polls
+  uint16_t skipped;  // polls skipped while open
+  uint16_t trials;   // half-open trial reads
+  uint32_t saved_ms; // bus time not spent on skipped polls
+};
+
+// Per-device response statistics keyed by Modbus unit ID.
+void deviceRecordRtt(uint8_t id, uint16_t rtt_ms);
+void deviceRecordTimeout(uint8_t id);
+uint16_t deviceTimeoutMs(uint8_t id, const TimeoutLimits &limits);
+
+// Circuit breaker: ask before polling, report the outcome afterwards.
+bool deviceShouldPoll(uint8_t id);
+void deviceReportPoll(uint8_t id, bool ok, uint32_t elapsed_ms);
+const DeviceHealthStats &deviceStats(uint8_t id);
+void deviceLogHealth();
@@ -12,5 +12,3 @@ void initEthernet();
 
 bool httpPostSensors(const char *host, uint16_t port, const char *path);
 bool httpPostSensors(const IPAddress &ip, uint16_t port, const char *path);
-
-bool pingId_Ethernet(const IPAddress &ip, uint16_t port, uint16_t timeoutMs);
\ No newline at end of file
@@ -0,0 +1,32 @@
+#pragma once
+#include "config.h"
+
+// Static arena of FRAME_POOL_SLOTS buffers of FRAME_SLOT_SIZE bytes shared
+// by Modbus TCP, bridge reads and the HTTP upload. A lease takes one or
+// more adjacent slots and gives them back when it goes out of scope.
+class FrameLease {
+public:
+  explicit FrameLease(uint8_t slots = 1);
+  ~FrameLease();
+
+  bool ok() const { return buf_ != nullptr; }
+  uint8_t *data() const { return buf_; }
+  char *chars() const { return reinterpret_cast<char *>(buf_); }
+  size_t size() const { return (size_t)slots_ * FRAME_SLOT_SIZE; }
+
+private:
+  FrameLease(const FrameLease &);
+  FrameLease &operator=(const FrameLease &);
+
+  uint8_t *buf_;
+  uint8_t slots_;
+};
+
+struct FramePoolStats {
+  uint8_t inUse;    // slots leased right now
+  uint8_t peak;     // most slots leased at once since boot
+  uint16_t refused; // leases that found no free run of slots
+};
+
+const FramePoolStats &framePoolStats();
+void framePoolLog();
@@ -0,0 +1,34 @@
+#pragma once
+#include "config.h"
+
+// Store-and-forward log of minute records in EEPROM (EEPROM_LOG_ADDR ..
+// EEPROM_LOG_END). Every closed minute is appended; the uploader sends the
+// oldest pending record and drops it once the server took it. Slots are
+// written in ring order, so wear is spread evenly. The ring holds
+// minuteLogCapacity() records (125 with 32 B slots): an outage up to that
+// many minutes loses nothing, a longer one overwrites the oldest pending
+// records and counts them in minuteLogOverwritten().
+struct MinuteRecord {
+  uint8_t boot;     // boot count, the newest record's + 1 at every start
+  uint16_t minute;  // aggregateInfo().seq when the minute closed
+  int16_t values[CH_COUNT]; // log units (minuteLogValue), INT16_MIN = no data
+};
+
+// Scans the ring once at boot: finds the write position, the oldest
+// pending record and this boot's number.
+void minuteLogInit();
+// Appends the minute collectAndAverageEveryMinute() just closed.
+void minuteLogAppend();
+
+uint16_t minuteLogPending();
+uint8_t minuteLogCapacity();
+// Pending records overwritten unsent since boot.
+uint16_t minuteLogOverwritten();
+uint8_t minuteLogBoot();
+// Oldest record not yet uploaded; false when the log is drained.
+bool minuteLogPeek(MinuteRecord &rec);
+// Drops the record minuteLogPeek() returned.
+void minuteLogMarkSent();
+
+// Channel value of a record in channel units, DEFAULT_SEND_VAL without data.
+float minuteLogValue(const MinuteRecord &rec, ChannelIndex ch);
@@ -0,0 +1,27 @@
+#pragma once
+#include <Arduino.h>
+
+// CRC-16/Modbus (reflected 0xA001, init 0xFFFF, sent low byte first).
+// MODBUS_CRC_TABLE picks the engine by flash budget:
+//   2 - 256-entry PROGMEM table (512 B), one lookup per byte
+//   1 - 16-entry nibble table (32 B), two lookups per byte
+//   0 - bitwise, no table
+#ifndef MODBUS_CRC_TABLE
+#define MODBUS_CRC_TABLE 2
+#endif
+
+constexpr uint16_t MODBUS_CRC_INIT = 0xFFFF;
+
+// Incremental form: feed bytes as they arrive. Running a whole frame
+// including its CRC leaves 0 when the frame is intact.
+uint16_t modbusCrcUpdate(uint16_t crc, uint8_t b);
+uint16_t modbusCrcUpdate(uint16_t crc, const uint8_t *p, size_t n);
+
+inline uint16_t crc16_modbus(const uint8_t *p, size_t n) {
+  return modbusCrcUpdate(MODBUS_CRC_INIT, p, n);
+}
+
+#ifdef MODBUS_CRC_BENCH
+// Logs the cost of the selected engine against the bitwise loop.
+void modbusCrcBenchmark();
+#endif
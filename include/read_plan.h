@@ -0,0 +1,23 @@
+#pragma once
+#include "config.h"
+
+// One coalesced FC3 read covering spans[first .. first+count-1].
+struct RegRead {
+  uint16_t addr;
+  uint16_t qty;
+  uint8_t first;
+  uint8_t count;
+};
+
+// Merges address-sorted spans of one unit into as few reads as possible:
+// neighbours are joined while the unused gap is <= maxGap registers and the
+// read stays within maxRegs. Returns number of reads, 0 if out is too small.
+uint8_t planRegisterReads(const RegSpan *spans, uint8_t n, uint16_t maxGap,
+                          uint16_t maxRegs, RegRead *out, uint8_t outMax);
+
+// Copies registers of every span served by rd from regs (the raw result of
+// rd) into out, where spans are packed back to back in table order.
+void sliceRegisterRead(const RegRead &rd, const RegSpan *spans,
+                       const uint16_t *regs, uint16_t *out);
+
+uint16_t maxReadRegsFor(uint8_t id);
@@ -0,0 +1,66 @@
+#pragma once
+#include "config.h"
+
+// Registers served over Modbus TCP, kept ready-encoded in wire order.
+// Each table has two copies; a publish fills the idle one and then flips,
+// so every reply is cut from one complete snapshot.
+enum RegisterTable : uint8_t {
+  REG_HOLDING, // FC3: send_arr, then the status block
+  REG_INPUT,   // FC4: live values and diagnostics
+};
+
+// Holding registers: send_arr as float32, two registers per value.
+constexpr uint16_t IMAGE_SEND_ARR_REGS = SEND_ARR_SIZE * 2;
+
+// Status block (read-only): aggregation sequence number (u32), seconds
+// since send_arr was computed, uptime in s (u32), then one register per
+// channel in ChannelIndex order: quality bits in the high byte, samples
+// behind the average in the low byte. A reader that sees the same
+// sequence number can skip send_arr.
+constexpr uint16_t HR_STATUS_ADDR = 64;
+constexpr uint16_t HR_STATUS_SEQ = HR_STATUS_ADDR;
+constexpr uint16_t HR_STATUS_AGE = HR_STATUS_ADDR + 2;
+constexpr uint16_t HR_STATUS_UPTIME = HR_STATUS_ADDR + 3;
+constexpr uint16_t HR_STATUS_CHANNELS = HR_STATUS_ADDR + 5;
+constexpr uint16_t HR_STATUS_REGS = 5 + CH_COUNT;
+constexpr uint16_t IMAGE_HOLDING_REGS = HR_STATUS_ADDR + HR_STATUS_REGS;
+static_assert(IMAGE_SEND_ARR_REGS <= HR_STATUS_ADDR, "send_arr overlaps status");
+
+enum ChannelQuality : uint8_t {
+  QUALITY_NO_DATA = 1 << 0, // no sample in the last minute
+  QUALITY_PARTIAL = 1 << 1, // fewer than samplesPerMinute()
+  QUALITY_STALE = 1 << 2,   // no fresh sample in the last sampled cycle
+};
+
+// Input registers: latest sample of every channel as float32 in
+// ChannelIndex order, then uptime in s (u32), stale channel mask,
+// discovered device mask, open breaker mask, frame pool refusals, the
+// SRAM low-water mark in bytes (sramLowWater()) and the minute records
+// overwritten unsent (minuteLogOverwritten()), then the age of every
+// live sample in 0.1 s at publish time (0xFFFF = older than that or
+// never sampled).
+constexpr uint16_t IR_LIVE_ADDR = 0;
+constexpr uint16_t IR_LIVE_REGS = CH_COUNT * 2;
+constexpr uint16_t IR_DIAG_ADDR = IR_LIVE_ADDR + IR_LIVE_REGS;
+constexpr uint16_t IR_DIAG_REGS = 8;
+constexpr uint16_t IR_AGE_ADDR = IR_DIAG_ADDR + IR_DIAG_REGS;
+constexpr uint16_t IR_AGE_REGS = CH_COUNT;
+constexpr uint16_t IMAGE_INPUT_REGS = IR_AGE_ADDR + IR_AGE_REGS;
+
+// Rollup history (rollup.h), read straight from the rings: ROLLUP_RECORD_REGS
+// per record, the minute records first, then quarter-hour, then hourly,
+// newest first within each level.
+constexpr uint16_t IR_ROLLUP_ADDR = 100;
+static_assert(IMAGE_INPUT_REGS <= IR_ROLLUP_ADDR, "input image overlaps rollups");
+
+// Re-encodes send_arr and the status block; call after every change to
+// send_arr.
+void registerImagePublish();
+// Refreshes the status block (age, uptime, quality) and the input
+// registers; called once per monitoring cycle.
+void registerImagePublishInput();
+
+// Copies count registers starting at addr into out (2 bytes each, big
+// endian per register). False if the range leaves the table.
+bool registerImageRead(RegisterTable table, uint16_t addr, uint16_t count,
+                       uint8_t *out);
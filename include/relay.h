@@ -2,12 +2,19 @@
 
 #include <Arduino.h>
 #include <Ethernet.h>
-extern uint8_t relay_on[];
-extern uint8_t relay_off[];
-
+#include "rs485_bus.h"
 extern bool relay_turn_off;
 extern bool relay_turn_on;
 
+// True while the router power-cycle pulse owns channel (CH between its
+// off and on writes); other writers must not touch it meanwhile.
+bool relayChannelLocked(uint8_t channel);
+// Queues an FC5 write of coil channel (0..RELAY_CHANNELS-1) on the relay
+// board at control priority; done gets the RTU reply (an FC5 echo).
+// False if the channel is locked or the RS-485 queue is full.
+bool relayWriteChannel(uint8_t channel, bool on, Rs485Callback done,
+                       void *ctx);
+
 void ensureNetOrRebootPort0();
 void initRelayHttp();
 void relayHttpServiceOnce();
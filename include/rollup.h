@@ -0,0 +1,63 @@
+#pragma once
+#include "config.h"
+
+// On-device history of the minute statistics: rings of 1-minute,
+// 15-minute and 60-minute aggregates per channel, merged incrementally
+// from the minute results (no raw samples are kept).
+enum RollupLevel : uint8_t {
+  ROLLUP_MINUTE,
+  ROLLUP_QUARTER,
+  ROLLUP_HOUR,
+  ROLLUP_LEVELS
+};
+
+// One channel of a record. mean is in channel fixed-point units; std and
+// the distances from mean down to min and up to max are in spread units
+// (rollupSpreadDiv() fixed-point steps) and saturate at 0xFFFF.
+struct RollupCell {
+  int32_t mean;
+  uint16_t std;
+  uint16_t belowMean;
+  uint16_t aboveMean;
+  uint16_t count; // samples behind the aggregate, 0 = no data
+};
+
+// Radiation is sent live and never averaged, so records carry no cell
+// for CH_R; the others keep ChannelIndex order.
+constexpr uint8_t ROLLUP_CHANNELS = CH_COUNT - 1;
+constexpr uint8_t rollupCellIndex(ChannelIndex ch) {
+  return ch < CH_R ? ch : ch - 1;
+}
+
+struct RollupRecord {
+  uint32_t seq; // aggregateInfo().seq of the minute that closed it, 0 = empty
+  RollupCell cells[ROLLUP_CHANNELS];
+};
+
+// Cell of ch, nullptr for CH_R.
+inline const RollupCell *rollupCell(const RollupRecord &rec, ChannelIndex ch) {
+  return ch == CH_R ? nullptr : &rec.cells[rollupCellIndex(ch)];
+}
+
+// Spread fields never resolve finer than 1/1000 of the channel unit, so
+// 16 bits cover 65 ppm of gas spread.
+constexpr int32_t rollupSpreadDiv(ChannelIndex ch) {
+  return channelScale(ch) > 1000 ? channelScale(ch) / 1000 : 1;
+}
+
+// Input registers per record: seq (u32), then per cell mean (i32), std,
+// below, above and count.
+constexpr uint16_t ROLLUP_CELL_REGS = 6;
+constexpr uint16_t ROLLUP_RECORD_REGS = 2 + ROLLUP_CHANNELS * ROLLUP_CELL_REGS;
+
+// Feeds the minute that collectAndAverageEveryMinute() just closed.
+void rollupAddMinute();
+
+// k-th newest record of a level, nullptr past the ring.
+const RollupRecord *rollupRecord(RollupLevel level, uint8_t k);
+uint8_t rollupSlots(RollupLevel level);
+
+// Records of all levels back to back, minute ring first, newest first
+// within a level; reg is relative to the start of the first record.
+uint16_t rollupRegisterCount();
+bool rollupReadRegs(uint16_t reg, uint16_t count, uint8_t *out);
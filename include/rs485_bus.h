@@ -0,0 +1,53 @@
+#pragma once
+#include "config.h"
+
+// Single owner of USART3 (Serial3 pins), Timer1 and RS485_DIR_PIN.
+// Requests are queued by priority and sent one at a time. Interrupts move
+// the bytes and close a reply after 3.5 characters of silence; the result
+// is delivered through a callback from rs485Service().
+
+enum Rs485Priority : uint8_t {
+  RS485_PRIO_CONTROL,    // relay commands
+  RS485_PRIO_POLL,       // routine sensor polling
+  RS485_PRIO_BACKGROUND, // probing, gateway traffic
+};
+
+enum Rs485Status : uint8_t {
+  RS485_OK,
+  RS485_EXCEPTION,  // device answered with a Modbus exception
+  RS485_TIMEOUT,
+  RS485_BAD_FRAME,  // wrong unit/function or CRC
+  RS485_EXPIRED,    // deadline passed before the bus was free
+  RS485_QUEUE_FULL,
+};
+
+struct Rs485Result {
+  Rs485Status status;
+  const uint8_t *resp; // reply ADU, valid only inside the callback
+  uint8_t len;
+  uint16_t elapsedMs; // request sent -> reply complete or timeout
+};
+
+typedef void (*Rs485Callback)(void *ctx, const Rs485Result &res);
+
+struct Rs485Request {
+  uint8_t adu[RS485_MAX_REQ]; // unit + PDU; CRC is appended on send
+  uint8_t len;                // without CRC
+  Rs485Priority priority;
+  uint32_t deadline;           // millis() by which the request must start
+  const TimeoutLimits *limits; // reply timeout class, nullptr = RTU
+  Rs485Callback done;
+  void *ctx;
+};
+
+void rs485Init();
+bool rs485Submit(const Rs485Request &req);
+void rs485Service();
+
+// Fill in a request with the deadline one monitoring cycle
+// (station_settings[SET_MONITOR_MS]) from now.
+void rs485PrepareRead(Rs485Request &req, uint8_t unit, uint16_t addr,
+                      uint16_t qty, Rs485Priority priority);
+void rs485PrepareWriteCoil(Rs485Request &req, uint8_t unit, uint16_t coil,
+                           bool on, Rs485Priority priority);
+uint16_t rtuRegister(const uint8_t *resp, uint8_t index);
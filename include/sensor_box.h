@@ -1,7 +1,9 @@
 #pragma once
-#include <ModbusMaster.h>
-
-extern ModbusMaster sensor_box;
+#include <Arduino.h>
+#include <Ethernet.h>
 
 void poll_SensorBox_SensorZTS3008(bool &alive1, bool &alive2, bool &alive3,
-                                  bool &alive4);
\ No newline at end of file
+                                  bool &alive4);
+// Discovered devices shown in the ID bar (active_ids, in unit ID order);
+// T/RH sensors have no slot.
+bool sensorHasSlot(uint8_t id);
@@ -0,0 +1,11 @@
+#pragma once
+#include <Arduino.h>
+
+// Free SRAM between the heap (or the end of .bss) and the stack.
+// sramPaint() fills that gap at boot; the bytes the stack has never
+// reached since are the margin left for static buffers such as the frame
+// pool and the rollup rings.
+void sramPaint();
+uint16_t sramFree();     // gap right now
+uint16_t sramLowWater(); // smallest gap since sramPaint()
+void sramLog();
@@ -1,4 +1,5 @@
 #pragma once
+#include "config.h"
 #include "serial.h"
 #include <Arduino.h>
 #include <string.h>
@@ -27,7 +28,9 @@
 #define TIME_CALL(label, call_expr) (void)(call_expr)
 #endif
 
-constexpr uint8_t SAMPLES_PER_MIN = 60;
+// Samples in a full minute at the current SET_MONITOR_MS (which the
+// settings write keeps a divisor of one minute).
+uint8_t samplesPerMinute();
 
 bool time_guard_allow(const char *key, uint32_t interval_ms,
                       bool wait_first = false);
@@ -37,16 +40,59 @@ struct _TimeGuardEntry {
   uint32_t last_ms;
 };
 
-bool rs485_acquire(uint16_t timeout_ms = 100);
-void rs485_release();
-
 size_t buildMbTcpRead03(uint8_t *out, uint16_t txId, uint8_t unit,
                         uint16_t addr, uint16_t qty);
 void printHex(const uint8_t *b, size_t n);
-void pre_transmission_main();
-void post_transmission_main();
 void collectAndAverageEveryMinute();
 
+// Bookkeeping of the last one-minute aggregation behind send_arr.
+struct AggregateInfo {
+  uint32_t seq;              // aggregations since boot
+  uint32_t computedMs;       // millis() when send_arr was rebuilt
+  uint8_t samples[CH_COUNT]; // fresh samples behind each channel average
+};
+const AggregateInfo &aggregateInfo();
+
+// Statistics of the last closed minute of a channel in fixed-point units
+// (sample count is in aggregateInfo().samples, meaningless if it is 0).
+struct MinuteStats {
+  int32_t mean;
+  int32_t std; // sample standard deviation, 0 for a single sample
+  int32_t min;
+  int32_t max;
+};
+const MinuteStats &minuteStats(ChannelIndex ch);
+
+// Raw register value that reads raw / rawDivider into channel units.
+inline int32_t fxFromRaw(ChannelIndex ch, int32_t raw, int32_t rawDivider) {
+  return channelScale(ch) >= rawDivider
+             ? raw * (channelScale(ch) / rawDivider)
+             : raw / (rawDivider / channelScale(ch));
+}
+// Integer square root rounded to nearest.
+uint32_t isqrt64(uint64_t v);
+
+#ifdef FIXED_POINT_BENCH
+// Logs one minute of decode -> accumulate -> average -> send_arr for every
+// channel, the float pipeline against the fixed-point one. Call before
+// polling starts: it leaves the minute statistics cleared.
+void fixedPointBenchmark();
+#endif
+
+// IEEE-754 value from a device; NaN reads as 0, overflow saturates.
+int32_t fxFromFloat(ChannelIndex ch, float v);
+inline float fxToFloat(ChannelIndex ch, int32_t fx) {
+  return fx * channelStep(ch);
+}
+
+// Latest per-second sample of a channel and the millis() it arrived at
+// (0 = never). Sources call markChannelsFresh() when they store values.
+float channelLiveValue(ChannelIndex ch);
+uint32_t channelSampleMs(ChannelIndex ch);
+void markChannelsFresh(uint16_t mask);
+// Copies live (non-averaged) values such as radiation into send_arr.
+void sendArrRefreshLive();
+
 template <typename T> void fill(T *mass, size_t count, T value) {
   for (size_t i = 0; i < count; ++i)
     mass[i] = value;
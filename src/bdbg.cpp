@@ -10,6 +10,7 @@ static uint8_t bdbg_idx = 0;
 static uint32_t bdbg_last_req = 0;
 static uint32_t bdbg_last_byte = 0;
 static uint32_t bdbg_first_deadline = 0;
+static uint32_t bdbg_last_line_us = 0; // last byte sent or received
 static bool bdbg_waiting = false;
 static bool bdbg_has_data = false;
 
@@ -22,12 +23,17 @@ void pollRadiation() {
   bdbgPeriodicRequest();
   while (Serial2.available()) {
     bdbgFeedByte(Serial2.read());
+    bdbg_last_line_us = micros();
   }
   bdbgTryFinalizeFrame();
 }
 
 static void bdbgPeriodicRequest() {
-  if (millis() - bdbg_last_req >= BDBG_TIME_SLEEP) {
+  if (millis() - bdbg_last_req >= station_settings[SET_BDBG_S] * SEC) {
+    // Line still busy: retry on the next loop instead of blocking here.
+    if (Serial2.available() || micros() - bdbg_last_line_us < BDBG_FRAME_GAP_US)
+      return;
+
     const uint8_t cmd[] = {0x55, 0xAA, 0x01};
     logLine("Start BDBG-09", true);
 
@@ -36,17 +42,11 @@ static void bdbgPeriodicRequest() {
     bdbg_has_data = false;
     bdbg_waiting = true;
 
-    while (Serial2.available())
-      (void)Serial2.read();
-
     digitalWrite(BDBG_DIR_PIN, HIGH);
-    delayMicroseconds(300);
-
     Serial2.write(cmd, sizeof(cmd));
-    Serial2.flush();
-
-    delayMicroseconds(1200);
+    Serial2.flush(); // returns once the last stop bit is out
     digitalWrite(BDBG_DIR_PIN, LOW);
+    bdbg_last_line_us = micros();
 
     logLine("[TX] ", false);
     bdbg_print_hex(cmd, sizeof(cmd));
@@ -87,7 +87,10 @@ static void bdbgTryFinalizeFrame() {
       uint32_t raw = ((uint32_t)bdbg_raw[6] << 24) |
                      ((uint32_t)bdbg_raw[5] << 16) |
                      ((uint32_t)bdbg_raw[4] << 8) | ((uint32_t)bdbg_raw[3]);
-      radiation_uSvh = raw / 100.0f;
+      // raw is in 0.01 uSv/h, which is the CH_R fixed-point unit
+      channel_fx[CH_R] = raw > INT32_MAX ? INT32_MAX : (int32_t)raw;
+      markChannelsFresh(chBit(CH_R));
+      sendArrRefreshLive();
     } else {
       logLine("BDBG: bad length=", false);
       logLine(bdbg_idx, true);
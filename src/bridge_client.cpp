@@ -0,0 +1,446 @@
+#include "bridge_client.h"
+#include "device_health.h"
+#include "frame_pool.h"
+#include "modbus_crc.h"
+#include "read_plan.h"
+#include "utils.h"
+#include "serial.h"
+
+static_assert(MBTCP_MAX_INFLIGHT <= 8, "pending replies are a uint8_t mask");
+static_assert(MBTCP_MAX_INFLIGHT * 12 <= FRAME_SLOT_SIZE,
+              "a request burst must fit one frame slot");
+
+// Open Modbus TCP connection to one bridge.
+struct MbTcpSession {
+  uint8_t id;      // unit ID of the bridge, 0 = free
+  uint16_t nextTx; // MBAP transaction ID of the next request
+  uint32_t lastUse;
+  EthernetClient client;
+};
+
+static MbTcpSession sessions[MBTCP_MAX_SESSIONS];
+
+// Datagram socket shared by all UDP bridges, opened on first use.
+static EthernetUDP udp;
+static bool udp_open = false;
+static uint16_t udp_next_tx = 0;
+
+static size_t buildMbRtuRead03(uint8_t *out, uint8_t unit, uint16_t addr,
+                               uint16_t qty);
+static bool readPlan(const BridgeEndpoint &b, const RegSpan *spans,
+                     const RegRead *plan, uint8_t n, uint16_t *out,
+                     uint16_t timeoutMs, bool *reached);
+static MbTcpSession *mbTcpSession(const BridgeEndpoint &b,
+                                  uint16_t timeoutMs);
+static void mbTcpClose(MbTcpSession &s);
+static bool mbTcpBurst(MbTcpSession &s, uint8_t unit, const RegSpan *spans,
+                       const RegRead *plan, uint8_t n, uint16_t *out,
+                       uint16_t timeoutMs);
+static bool udpReadRegs(const BridgeEndpoint &b, uint16_t addr, uint16_t qty,
+                        uint16_t *regs, uint16_t timeoutMs, bool *reached);
+static bool isUdp(const BridgeEndpoint &b);
+
+const BridgeEndpoint *bridgeFor(uint8_t id) {
+  for (uint8_t i = 0; i < BRIDGES_CNT; ++i)
+    if (BRIDGES[i].id == id)
+      return &BRIDGES[i];
+  return nullptr;
+}
+
+uint16_t bridgeTimeoutMs(uint8_t id) {
+  const BridgeEndpoint *b = bridgeFor(id);
+  if (b != nullptr && isUdp(*b))
+    return deviceTimeoutMs(id, BRIDGE_UDP_TIMEOUTS);
+  return deviceTimeoutMs(id, BRIDGE_TIMEOUTS);
+}
+
+bool bridgeReadRegs(const BridgeEndpoint &b, uint16_t addr, uint16_t qty,
+                    uint16_t *regs, uint16_t timeoutMs, bool *reached) {
+  if (reached != nullptr)
+    *reached = false;
+  if (qty == 0 || qty > MB_MAX_READ_REGS)
+    return false;
+  RegSpan span = {addr, qty};
+  RegRead rd = {addr, qty, 0, 1};
+  return readPlan(b, &span, &rd, 1, regs, timeoutMs, reached);
+}
+
+bool bridgeReadSpans(const BridgeEndpoint &b, const RegSpan *spans,
+                     uint8_t n, uint16_t *out, uint16_t timeoutMs) {
+  RegRead plan[4];
+  uint16_t maxRegs = maxReadRegsFor(b.id);
+  if (maxRegs > MB_MAX_READ_REGS)
+    maxRegs = MB_MAX_READ_REGS;
+  uint8_t reads = planRegisterReads(spans, n, MB_COALESCE_MAX_GAP, maxRegs,
+                                    plan, ARRLEN(plan));
+  if (reads == 0)
+    return false;
+  return readPlan(b, spans, plan, reads, out, timeoutMs, nullptr);
+}
+
+static bool readPlan(const BridgeEndpoint &b, const RegSpan *spans,
+                     const RegRead *plan, uint8_t n, uint16_t *out,
+                     uint16_t timeoutMs, bool *reached) {
+  if (reached != nullptr)
+    *reached = false;
+
+  if (b.transport == BRIDGE_MODBUS_TCP) {
+    MbTcpSession *s = mbTcpSession(b, timeoutMs);
+    if (s == nullptr)
+      return false;
+    if (reached != nullptr)
+      *reached = true;
+    for (uint8_t r = 0; r < n; r += MBTCP_MAX_INFLIGHT) {
+      uint8_t burst = n - r;
+      if (burst > MBTCP_MAX_INFLIGHT)
+        burst = MBTCP_MAX_INFLIGHT;
+      if (!mbTcpBurst(*s, b.id, spans, plan + r, burst, out, timeoutMs)) {
+        mbTcpClose(*s);
+        return false;
+      }
+    }
+    logLine(F("----------------------"), true);
+    return true;
+  }
+
+  uint16_t regs[MB_MAX_READ_REGS];
+  for (uint8_t r = 0; r < n; ++r) {
+    bool ok = isUdp(b) ? udpReadRegs(b, plan[r].addr, plan[r].qty, regs,
+                                     timeoutMs, reached)
+                       : rtuOverTcpReadRegs(regs, b.ip, b.port, b.id,
+                                            plan[r].addr, plan[r].qty,
+                                            timeoutMs, reached);
+    if (!ok)
+      return false;
+    sliceRegisterRead(plan[r], spans, regs, out);
+  }
+  return true;
+}
+
+static bool isUdp(const BridgeEndpoint &b) {
+  return b.transport == BRIDGE_RTU_UDP || b.transport == BRIDGE_MODBUS_UDP;
+}
+
+// One datagram per try; the request is resent unchanged (same
+// transaction ID) after timeoutMs, so a late reply to an earlier try
+// still answers it. Datagrams from other hosts or for other requests are
+// dropped.
+static bool udpReadRegs(const BridgeEndpoint &b, uint16_t addr, uint16_t qty,
+                        uint16_t *regs, uint16_t timeoutMs, bool *reached) {
+  if (!udp_open)
+    udp_open = udp.begin(BRIDGE_UDP_LOCAL_PORT);
+  if (!udp_open)
+    return false;
+  FrameLease frame;
+  if (!frame.ok())
+    return false;
+  uint8_t *buf = frame.data();
+
+  bool mbap = b.transport == BRIDGE_MODBUS_UDP;
+  uint16_t txId = udp_next_tx++;
+  uint8_t req[12];
+  size_t len = mbap ? buildMbTcpRead03(req, txId, b.id, addr, qty)
+                    : buildMbRtuRead03(req, b.id, addr, qty);
+
+  while (udp.parsePacket() > 0)
+    ; // leftovers of an abandoned read
+
+  for (uint8_t attempt = 0; attempt <= BRIDGE_UDP_RETRIES; ++attempt) {
+    if (attempt > 0) {
+      logLine(F("UDP retransmit id "), false);
+      logLine(b.id, true);
+    }
+    udp.beginPacket(b.ip, b.port);
+    udp.write(req, len);
+    if (!udp.endPacket())
+      continue;
+
+    uint32_t t0 = millis();
+    while (millis() - t0 < timeoutMs) {
+      if (udp.parsePacket() <= 0 || udp.remoteIP() != b.ip)
+        continue;
+      int got = udp.read(buf, frame.size());
+
+      const uint8_t *pdu = buf; // unit, FC, byte count, data
+      int pduLen = got - 2;     // without CRC
+      if (mbap) {
+        if (got < 9 || buf[2] != 0 || buf[3] != 0 ||
+            (((uint16_t)buf[0] << 8) | buf[1]) != txId)
+          continue;
+        pdu = buf + 6;
+        pduLen = got - 6;
+      } else if (got < 5 || crc16_modbus(buf, got) != 0) {
+        continue;
+      }
+      if (pdu[0] != b.id)
+        continue;
+
+      if (reached != nullptr)
+        *reached = true;
+      if (pdu[1] == (0x03 | 0x80)) {
+        logLine(F("UDP exception code=0x"), false);
+        logLine(pdu[2], HEX, true);
+        return false;
+      }
+      if (pdu[1] != 0x03 || pdu[2] != qty * 2 || pduLen < 3 + qty * 2)
+        continue;
+      for (uint16_t i = 0; i < qty; ++i)
+        regs[i] = ((uint16_t)pdu[3 + i * 2] << 8) | pdu[4 + i * 2];
+      deviceRecordRtt(b.id, millis() - t0);
+      return true;
+    }
+  }
+
+  logLine(F("UDP no reply from id "), false);
+  logLine(b.id, true);
+  deviceRecordTimeout(b.id);
+  return false;
+}
+
+// Reuses the bridge's open socket; otherwise takes a free or the least
+// recently used session and connects it within timeoutMs.
+static MbTcpSession *mbTcpSession(const BridgeEndpoint &b,
+                                  uint16_t timeoutMs) {
+  MbTcpSession *s = nullptr;
+  for (uint8_t i = 0; i < MBTCP_MAX_SESSIONS && s == nullptr; ++i)
+    if (sessions[i].id == b.id)
+      s = &sessions[i];
+  if (s == nullptr) {
+    s = &sessions[0];
+    for (uint8_t i = 1; i < MBTCP_MAX_SESSIONS; ++i) {
+      if (s->id == 0)
+        break;
+      if (sessions[i].id == 0 ||
+          millis() - sessions[i].lastUse > millis() - s->lastUse)
+        s = &sessions[i];
+    }
+    mbTcpClose(*s);
+  }
+
+  if (!s->client.connected()) {
+    s->client.stop();
+    logLine(F("Connect Modbus TCP "), false);
+    logLine(b.ip, false);
+    logLine(F(":"), false);
+    logLine(b.port, true);
+    s->client.setConnectionTimeout(timeoutMs);
+    if (!s->client.connect(b.ip, b.port)) {
+      logLine(F("Modbus TCP connect failed"), true);
+      mbTcpClose(*s);
+      return nullptr;
+    }
+  }
+  s->id = b.id;
+  s->lastUse = millis();
+  return s;
+}
+
+static void mbTcpClose(MbTcpSession &s) {
+  s.client.stop();
+  s.id = 0;
+}
+
+// Writes n MBAP requests back to back, then collects the replies in any
+// order and matches them to the plan by transaction ID. timeoutMs bounds
+// the wait for each next reply, not the whole burst.
+static bool mbTcpBurst(MbTcpSession &s, uint8_t unit, const RegSpan *spans,
+                       const RegRead *plan, uint8_t n, uint16_t *out,
+                       uint16_t timeoutMs) {
+  FrameLease frame;
+  if (!frame.ok())
+    return false;
+  uint8_t *buf = frame.data();
+
+  while (s.client.available())
+    s.client.read(); // late replies of an abandoned burst
+
+  uint16_t txBase = s.nextTx;
+  s.nextTx += n;
+  size_t len = 0;
+  for (uint8_t i = 0; i < n; ++i)
+    len += buildMbTcpRead03(buf + len, txBase + i, unit, plan[i].addr,
+                            plan[i].qty);
+  size_t sent = s.client.write(buf, len);
+  s.client.flush();
+  logLine(F("Sent MBAP x"), false);
+  logLine(n, false);
+  logLine(F(", "), false);
+  logLine(sent, false);
+  logLine(F(" bytes:"), true);
+  printHex(buf, len);
+  if (sent != len)
+    return false;
+
+  uint8_t pending = (uint8_t)((1u << n) - 1);
+  uint16_t regs[MB_MAX_READ_REGS];
+  size_t got = 0;
+  uint32_t t0 = millis();
+  uint32_t last = t0;
+  bool first = true;
+  while (pending != 0 && millis() - last < timeoutMs) {
+    while (s.client.available() && got < frame.size())
+      buf[got++] = s.client.read();
+
+    while (got >= 7) {
+      size_t flen = 6 + (((size_t)buf[4] << 8) | buf[5]);
+      if (buf[2] != 0 || buf[3] != 0 || flen < 9 || flen > frame.size()) {
+        logLine(F("MBAP framing lost"), true);
+        return false;
+      }
+      if (got < flen)
+        break;
+
+      uint16_t idx = (uint16_t)(((uint16_t)buf[0] << 8) | buf[1]) - txBase;
+      if (idx < n && (pending & (1u << idx)) && buf[6] == unit) {
+        if (buf[7] == (0x03 | 0x80)) {
+          logLine(F("MBAP exception code=0x"), false);
+          logLine(buf[8], HEX, true);
+          return false;
+        }
+        uint16_t qty = plan[idx].qty;
+        if (buf[7] != 0x03 || buf[8] != qty * 2 || flen != 9 + qty * 2u)
+          return false;
+        for (uint16_t i = 0; i < qty; ++i)
+          regs[i] = ((uint16_t)buf[9 + i * 2] << 8) | buf[10 + i * 2];
+        sliceRegisterRead(plan[idx], spans, regs, out);
+        pending &= ~(1u << idx);
+        last = millis();
+        if (first)
+          deviceRecordRtt(unit, last - t0);
+        first = false;
+      }
+      got -= flen;
+      memmove(buf, buf + flen, got);
+    }
+
+    if (!s.client.connected() && s.client.available() == 0)
+      break;
+  }
+
+  if (pending != 0) {
+    logLine(F("MBAP replies missing: "), false);
+    logLine(pending, BIN, true);
+    if (millis() - last >= timeoutMs)
+      deviceRecordTimeout(unit);
+    return false;
+  }
+  s.lastUse = millis();
+  return true;
+}
+
+static size_t buildMbRtuRead03(uint8_t *out, uint8_t unit, uint16_t addr,
+                               uint16_t qty) {
+  out[0] = unit;
+  out[1] = 0x03;
+  out[2] = addr >> 8;
+  out[3] = addr;
+  out[4] = qty >> 8;
+  out[5] = qty;
+
+  uint16_t crc = crc16_modbus(out, 6);
+  out[6] = crc & 0xFF;
+  out[7] = crc >> 8;
+  return 8;
+}
+
+bool rtuOverTcpReadRegs(uint16_t *regs, const IPAddress &ip, uint16_t port,
+                        uint8_t unit, uint16_t addr, uint16_t qty,
+                        uint16_t timeoutMs, bool *reached) {
+  if (reached != nullptr)
+    *reached = false;
+  FrameLease frame;
+  if (!frame.ok())
+    return false;
+  uint8_t *resp = frame.data();
+
+  uint8_t req[8] = {0};
+  size_t len = buildMbRtuRead03(req, unit, addr, qty);
+
+  EthernetClient client;
+  logLine(F("Connect RTU/TCP "), false);
+  logLine(ip, false);
+  logLine(F(":"), false);
+  logLine(port, true);
+  client.setConnectionTimeout(timeoutMs); // an absent bridge costs one timeout
+  bool connected = client.connect(ip, port);
+  if (reached != nullptr)
+    *reached = connected;
+  if (!connected) {
+    logLine(F("RTU/TCP connect failed"), true);
+    client.stop();
+    return false;
+  }
+
+  size_t sent = client.write(req, len);
+  client.flush();
+  logLine(F("Sent RTU "), false);
+  logLine(sent, false);
+  logLine(F(" bytes:"), true);
+  printHex(req, len);
+  if (sent != len) {
+    client.stop();
+    return false;
+  }
+
+  size_t got = 0;
+  size_t expected = 0;
+  uint32_t t0 = millis();
+  while (millis() - t0 < timeoutMs) {
+    while (client.available() && got < frame.size()) {
+      resp[got++] = client.read();
+      if (got >= 3 && resp[1] == 0x03) {
+        expected = (size_t)resp[2] + 5;
+      } else if (got >= 2 && resp[1] == (0x03 | 0x80)) {
+        expected = 5;
+      }
+    }
+    if (expected > 0 && got >= expected)
+      break;
+    if (!client.connected() && client.available() == 0)
+      break;
+  }
+  uint32_t rtt = millis() - t0;
+  client.stop();
+
+  if (expected > 0 && got >= expected)
+    deviceRecordRtt(unit, rtt);
+  else if (rtt >= timeoutMs)
+    deviceRecordTimeout(unit);
+
+  logLine(F("Recv RTU "), false);
+  logLine(got, false);
+  logLine(F(" bytes:"), true);
+  if (got)
+    printHex(resp, got);
+
+  if (got < 5 || resp[0] != unit)
+    return false;
+  if (resp[1] == (0x03 | 0x80)) {
+    logLine(F("RTU exception code=0x"), false);
+    logLine(resp[2], HEX, true);
+    return false;
+  }
+  if (resp[1] != 0x03)
+    return false;
+
+  uint8_t byteCount = resp[2];
+  expected = (size_t)byteCount + 5;
+  if (got < expected || byteCount != qty * 2)
+    return false;
+
+  uint16_t gotCrc =
+      (uint16_t)resp[expected - 2] | ((uint16_t)resp[expected - 1] << 8);
+  uint16_t calcCrc = crc16_modbus(resp, expected - 2);
+  if (gotCrc != calcCrc) {
+    logLine(F("RTU CRC mismatch"), true);
+    return false;
+  }
+
+  for (uint16_t i = 0; i < qty; ++i) {
+    uint8_t *p = resp + 3 + i * 2;
+    regs[i] = ((uint16_t)p[0] << 8) | p[1];
+  }
+
+  logLine(F("----------------------"), true);
+  return true;
+}
@@ -0,0 +1,489 @@
+#include "bus_topology.h"
+#include "bridge_client.h"
+#include "channel_map.h"
+#include "device_health.h"
+#include "eth_manager.h"
+#include "modbus_crc.h"
+#include "rs485_bus.h"
+#include "serial.h"
+
+static_assert(DISCOVERY_ID_LAST <= MAX_DEVICE_ID, "scan range exceeds IDs");
+
+constexpr uint8_t TOPOLOGY_VERSION = 2; // 2: PROFILE_BRIDGE_GAS_SPLIT
+
+// Probe signatures: largest raw reading a gas or PM device reports, and
+// the float32 exponents (biased) a gas concentration can have, 2^-20 to
+// 2^16.
+constexpr uint16_t SIG_MAX_RAW = 50000;
+constexpr uint8_t SIG_MIN_EXP = 127 - 20;
+constexpr uint8_t SIG_MAX_EXP = 127 + 16;
+
+// EEPROM image; crc covers version and topology.
+struct TopologyRecord {
+  uint8_t version;
+  BusTopology topo;
+  uint16_t crc;
+};
+static_assert(EEPROM_TOPOLOGY_ADDR + sizeof(TopologyRecord) <=
+                  EEPROM_CHANNEL_MAP_ADDR,
+              "topology record runs into the channel map");
+
+// Probe of one ID, advanced one read per cycle in the background; during
+// a full scan RTU reads follow each other from the reply callback.
+struct BackgroundProbe {
+  uint8_t id;    // 0 = pick the next ID
+  uint8_t next;  // index into RTU_PROBES / BRIDGE_PROBES
+  uint8_t matches;     // probes whose signature matched
+  DeviceProfile found; // profile of the last match
+  bool answered; // unit replied to something (bridge: TCP connect ok)
+  bool pending;  // RS-485 read queued
+};
+
+BusTopology bus_topology;
+
+static bool discovery_requested = false;
+static BackgroundProbe bg = {0, 0, 0, PROFILE_NONE, false, false};
+static uint8_t bg_cursor = 0;
+
+// Full scan in progress: results collect in scan_found and replace
+// bus_topology once every candidate ID has been probed.
+static bool scanning = false;
+static uint8_t scan_cursor = 0;
+static uint32_t scan_started_ms = 0;
+static BusTopology scan_found;
+
+// Background changes wait TOPOLOGY_SAVE_SETTLE_MS without a further
+// change before they are written, so a flapping device costs no wear.
+static bool topology_dirty = false;
+static uint32_t topology_changed_ms = 0;
+
+static const ProfileProbe *findProbe(DeviceProfile profile);
+static bool isBridgeId(uint8_t id);
+static bool isCandidateId(uint8_t id);
+static bool topologyEmpty(const BusTopology &topo);
+static void dropVanished();
+static void probeStep(bool allowBridge);
+static bool pickProbeId();
+static void bridgeProbeStep();
+static void onProbeReply(void *ctx, const Rs485Result &res);
+static void probeOutcome(bool full, bool answered, const uint16_t *regs,
+                         uint32_t elapsed_ms);
+static bool skipToApplicable();
+static const ProfileProbe *probeList(uint8_t id, uint8_t &count);
+static bool signatureMatches(DeviceProfile profile, const uint16_t *regs);
+static bool plausibleFloat(uint16_t first, uint16_t second);
+static void finishProbe(DeviceProfile profile, uint32_t elapsed_ms);
+static void finishScan();
+static void topologyChanged();
+static void saveIfSettled();
+static uint8_t nextAbsentId(uint8_t after);
+static uint16_t recordCrc(const TopologyRecord &rec);
+static const char *profileName(DeviceProfile profile);
+
+bool topologyLoad() {
+  TopologyRecord rec;
+  EEPROM.get(EEPROM_TOPOLOGY_ADDR, rec);
+  if (rec.version != TOPOLOGY_VERSION || rec.crc != recordCrc(rec)) {
+    logLine("Topology: no valid record in EEPROM", true);
+    return false;
+  }
+  bus_topology = rec.topo;
+  logLine("Topology: loaded from EEPROM", true);
+  topologyLog();
+  return true;
+}
+
+void topologySave() {
+  TopologyRecord rec;
+  rec.version = TOPOLOGY_VERSION;
+  rec.topo = bus_topology;
+  rec.crc = recordCrc(rec);
+  EEPROM.put(EEPROM_TOPOLOGY_ADDR, rec); // update(): unchanged cells kept
+  topology_dirty = false;
+}
+
+void topologyDiscover() {
+  logLine("Topology: discovery start", true);
+  discovery_requested = false;
+  scanning = true;
+  scan_cursor = 0;
+  scan_started_ms = millis();
+  memset(&scan_found, 0, sizeof(scan_found));
+  bg.id = 0; // a queued background reply is ignored
+  probeStep(false);
+}
+
+void topologyRequestDiscovery() { discovery_requested = true; }
+
+void topologyForget(uint8_t id) {
+  if (id > MAX_DEVICE_ID || bus_topology.profile[id] == PROFILE_NONE)
+    return;
+  if (bg.id == id)
+    bg.id = 0; // a queued reply is ignored
+  bus_topology.profile[id] = PROFILE_NONE;
+  bus_topology.bridged &= ~(1u << id);
+  topologyChanged();
+}
+
+void topologyService() {
+  if (discovery_requested)
+    topologyDiscover();
+  else if (!scanning)
+    dropVanished();
+  probeStep(true);
+  saveIfSettled();
+}
+
+bool topologyHas(uint8_t id) {
+  return id <= MAX_DEVICE_ID && bus_topology.profile[id] > PROFILE_UNKNOWN;
+}
+
+bool topologyIsBridged(uint8_t id) {
+  return id <= MAX_DEVICE_ID && (bus_topology.bridged & (1u << id));
+}
+
+const RegSpan *topologyBlock(uint8_t id) {
+  if (!topologyHas(id))
+    return nullptr;
+  const ProfileProbe *probe = findProbe(bus_topology.profile[id]);
+  return probe ? &probe->block : nullptr;
+}
+
+void topologyLog() {
+  logLine("Topology:", false);
+  for (uint8_t id = 1; id <= MAX_DEVICE_ID; ++id) {
+    DeviceProfile p = bus_topology.profile[id];
+    if (p == PROFILE_NONE)
+      continue;
+    logLine(" ", false);
+    logLine(id, false);
+    logLine(topologyIsBridged(id) ? "@tcp=" : "=", false);
+    logLine(profileName(p), false);
+  }
+  logLine("", true);
+}
+
+static void dropVanished() {
+  for (uint8_t id = 1; id <= MAX_DEVICE_ID; ++id) {
+    if (!topologyHas(id))
+      continue;
+    const DeviceHealthStats &st = deviceStats(id);
+    if (st.state != DEV_OPEN || st.failures < TOPOLOGY_DROP_AFTER)
+      continue;
+    bus_topology.profile[id] = PROFILE_NONE;
+    bus_topology.bridged &= ~(1u << id);
+    logLine("Topology: dropped id ", false);
+    logLine(id, true);
+    topologyChanged();
+  }
+}
+
+// Bridge reads block on TCP, so they only run from topologyService(), one
+// per cycle; RTU reads are queued and answered through onProbeReply().
+static void probeStep(bool allowBridge) {
+  if (bg.pending)
+    return;
+  if (bg.id == 0 && !pickProbeId())
+    return;
+  if (isBridgeId(bg.id)) {
+    if (allowBridge)
+      bridgeProbeStep();
+    return;
+  }
+
+  const RegSpan &block = RTU_PROBES[bg.next].block;
+  Rs485Request req;
+  rs485PrepareRead(req, bg.id, block.addr, block.qty, RS485_PRIO_BACKGROUND);
+  req.limits = &PROBE_TIMEOUTS;
+  req.done = onProbeReply;
+  req.ctx = &bg;
+  if (rs485Submit(req))
+    bg.pending = true;
+}
+
+// Next ID to probe: the next candidate of a running scan (finishing it
+// after the last one), otherwise the next absent ID.
+static bool pickProbeId() {
+  uint8_t id = 0;
+  if (scanning) {
+    for (uint8_t n = scan_cursor + 1; n <= MAX_DEVICE_ID && id == 0; ++n)
+      if (isCandidateId(n))
+        id = n;
+    if (id == 0) {
+      finishScan();
+      return false;
+    }
+  } else {
+    id = nextAbsentId(bg_cursor);
+    if (id == 0)
+      return false;
+  }
+  bg.id = id;
+  bg.next = 0;
+  bg.matches = 0;
+  bg.answered = false;
+  if (skipToApplicable())
+    return true;
+  finishProbe(PROFILE_NONE, 0); // pinned to a profile nothing probes
+  return false;
+}
+
+// One register-map read per step, connect included bounded by
+// PROBE_TIMEOUTS.maxMs; a failed connect ends the probe. Only one bridge
+// step runs per cycle, whether in the background or during a scan.
+static void bridgeProbeStep() {
+  const BridgeEndpoint *b = bridgeFor(bg.id);
+
+  uint32_t t0 = millis();
+  uint16_t regs[MB_MAX_READ_REGS];
+  const ProfileProbe &probe = BRIDGE_PROBES[bg.next];
+  bool reached = false;
+  uint16_t timeout = bridgeTimeoutMs(bg.id);
+  if (timeout > PROBE_TIMEOUTS.maxMs)
+    timeout = PROBE_TIMEOUTS.maxMs; // connect + reply of an absent bridge
+  bool full = bridgeReadRegs(*b, probe.block.addr, probe.block.qty, regs,
+                             timeout, &reached);
+  probeOutcome(full, reached, regs, millis() - t0);
+}
+
+static void onProbeReply(void *ctx, const Rs485Result &res) {
+  BackgroundProbe &p = *static_cast<BackgroundProbe *>(ctx);
+  p.pending = false;
+  if (p.id != 0) {
+    const RegSpan &block = RTU_PROBES[p.next].block;
+    bool full = res.status == RS485_OK && res.len >= 5 + block.qty * 2 &&
+                res.resp[2] == block.qty * 2;
+    uint16_t regs[RS485_MAX_READ_REGS];
+    for (uint8_t i = 0; full && i < block.qty; ++i)
+      regs[i] = rtuRegister(res.resp, i);
+    bool answered = res.status == RS485_OK || res.status == RS485_EXCEPTION ||
+                    res.status == RS485_BAD_FRAME;
+    probeOutcome(full, answered, regs, res.elapsedMs);
+  }
+  if (scanning)
+    probeStep(false); // the scan goes on at bus speed
+}
+
+// A unit pinned by the channel map only gets its profile's probe and any
+// full reply confirms it. Otherwise every probe runs and a full reply
+// counts only if its registers carry the profile's signature: exactly one
+// match classifies the unit, several leave it unknown (fail closed).
+// Absent units are dropped after the first timeout; a unit that raised an
+// exception is present and gets the remaining probes.
+static void probeOutcome(bool full, bool answered, const uint16_t *regs,
+                         uint32_t elapsed_ms) {
+  uint8_t count = 0;
+  const ProfileProbe &probe = probeList(bg.id, count)[bg.next];
+  if (full) {
+    bg.answered = true;
+    if (channelMapProfile(bg.id) != PROFILE_NONE) {
+      finishProbe(probe.profile, elapsed_ms);
+      return;
+    }
+    if (signatureMatches(probe.profile, regs)) {
+      bg.matches++;
+      bg.found = probe.profile;
+    }
+  } else if (answered) {
+    bg.answered = true;
+  } else if (!bg.answered) {
+    finishProbe(PROFILE_NONE, elapsed_ms);
+    return;
+  }
+
+  bg.next++;
+  if (skipToApplicable())
+    return;
+  if (bg.matches == 1) {
+    finishProbe(bg.found, elapsed_ms);
+    return;
+  }
+  if (bg.matches > 1) {
+    logLine("Topology: id ", false);
+    logLine(bg.id, false);
+    logLine(" matches several profiles, pin it in the channel map", true);
+  }
+  finishProbe(bg.answered ? PROFILE_UNKNOWN : PROFILE_NONE, elapsed_ms);
+}
+
+// Moves bg.next to the next probe allowed for bg.id; false past the end.
+static bool skipToApplicable() {
+  uint8_t count = 0;
+  const ProfileProbe *list = probeList(bg.id, count);
+  DeviceProfile pinned = channelMapProfile(bg.id);
+  while (bg.next < count && pinned != PROFILE_NONE &&
+         list[bg.next].profile != pinned)
+    bg.next++;
+  return bg.next < count;
+}
+
+static const ProfileProbe *probeList(uint8_t id, uint8_t &count) {
+  if (isBridgeId(id)) {
+    count = BRIDGE_PROBES_CNT;
+    return BRIDGE_PROBES;
+  }
+  count = RTU_PROBES_CNT;
+  return RTU_PROBES;
+}
+
+// Register contents that the profile's own map produces: plausible
+// concentrations, PM2.5 not above PM10, RH 0..100 % and T -40..85 C.
+static bool signatureMatches(DeviceProfile profile, const uint16_t *regs) {
+  switch (profile) {
+  case PROFILE_GAS_F32:
+    return plausibleFloat(regs[0], regs[1]) &&
+           plausibleFloat(regs[2], regs[3]) &&
+           plausibleFloat(regs[4], regs[5]);
+  case PROFILE_BRIDGE_GAS:
+  case PROFILE_BRIDGE_GAS_SPLIT:
+    return plausibleFloat(regs[0], regs[1]);
+  case PROFILE_GAS_U16:
+    return regs[1] <= SIG_MAX_RAW && regs[3] <= SIG_MAX_RAW &&
+           regs[5] <= SIG_MAX_RAW;
+  case PROFILE_PM:
+  case PROFILE_BRIDGE_PM:
+    return regs[0] <= regs[1] && regs[1] <= SIG_MAX_RAW;
+  case PROFILE_TEMP_RH:
+    return regs[0] <= 100 * divider_t_rh &&
+           (int16_t)regs[1] >= -40 * divider_t_rh &&
+           (int16_t)regs[1] <= 85 * divider_t_rh;
+  default:
+    return false;
+  }
+}
+
+// Zero or a positive normal float32 within the SIG_*_EXP range, words in
+// the devices' order (low word first, see floatFromWords()).
+static bool plausibleFloat(uint16_t first, uint16_t second) {
+  uint32_t raw = ((uint32_t)second << 16) | first;
+  if (raw == 0)
+    return true;
+  uint8_t exp = raw >> 23;
+  return !(raw & 0x80000000UL) && exp >= SIG_MIN_EXP && exp <= SIG_MAX_EXP;
+}
+
+static void finishProbe(DeviceProfile profile, uint32_t elapsed_ms) {
+  uint8_t id = bg.id;
+  bg.id = 0;
+  if (scanning) {
+    scan_cursor = id;
+    scan_found.profile[id] = profile;
+    if (profile != PROFILE_NONE && isBridgeId(id))
+      scan_found.bridged |= 1u << id;
+    return;
+  }
+  bg_cursor = id;
+  if (bus_topology.profile[id] == profile)
+    return;
+
+  bus_topology.profile[id] = profile;
+  if (profile != PROFILE_NONE && isBridgeId(id))
+    bus_topology.bridged |= 1u << id;
+  else
+    bus_topology.bridged &= ~(1u << id);
+  topologyChanged();
+  if (!topologyHas(id))
+    return;
+  logLine("Topology: found id ", false);
+  logLine(id, false);
+  logLine(" = ", false);
+  logLine(profileName(profile), false);
+  logLine(channelMapAny(id) ? "" : ", no channel map: not polled", true);
+  deviceReportPoll(id, true, elapsed_ms); // close a stale breaker
+}
+
+static void finishScan() {
+  scanning = false;
+  logLine("Topology: discovery took ", false);
+  logLine(millis() - scan_started_ms, false);
+  logLine(" ms", true);
+
+  // An empty scan usually means the bus is down; keep the old record.
+  if (topologyEmpty(scan_found)) {
+    logLine("Topology: scan found nothing, kept the old record", true);
+    return;
+  }
+  bus_topology = scan_found;
+  topologyLog();
+  topologySave();
+}
+
+static void topologyChanged() {
+  topology_dirty = true;
+  topology_changed_ms = millis();
+}
+
+static void saveIfSettled() {
+  if (topology_dirty &&
+      millis() - topology_changed_ms >= TOPOLOGY_SAVE_SETTLE_MS) {
+    logLine("Topology: saved", true);
+    topologySave();
+  }
+}
+
+// Round robin over absent IDs; 0 when every candidate is present.
+static uint8_t nextAbsentId(uint8_t after) {
+  for (uint8_t n = 1; n <= MAX_DEVICE_ID; ++n) {
+    uint8_t id = (after + n - 1) % MAX_DEVICE_ID + 1;
+    if (!topologyHas(id) && isCandidateId(id))
+      return id;
+  }
+  return 0;
+}
+
+// Bridged IDs and the Serial3 scan range, without the relay.
+static bool isCandidateId(uint8_t id) {
+  if (id == UNIT_ID)
+    return false;
+  return isBridgeId(id) ||
+         (id >= DISCOVERY_ID_FIRST && id <= DISCOVERY_ID_LAST);
+}
+
+static const ProfileProbe *findProbe(DeviceProfile profile) {
+  for (uint8_t i = 0; i < RTU_PROBES_CNT; ++i)
+    if (RTU_PROBES[i].profile == profile)
+      return &RTU_PROBES[i];
+  for (uint8_t i = 0; i < BRIDGE_PROBES_CNT; ++i)
+    if (BRIDGE_PROBES[i].profile == profile)
+      return &BRIDGE_PROBES[i];
+  return nullptr;
+}
+
+static bool isBridgeId(uint8_t id) {
+  return bridgeFor(id) != nullptr;
+}
+
+static bool topologyEmpty(const BusTopology &topo) {
+  for (uint8_t id = 1; id <= MAX_DEVICE_ID; ++id)
+    if (topo.profile[id] > PROFILE_UNKNOWN)
+      return false;
+  return true;
+}
+
+static uint16_t recordCrc(const TopologyRecord &rec) {
+  return crc16_modbus(reinterpret_cast<const uint8_t *>(&rec),
+                      offsetof(TopologyRecord, crc));
+}
+
+static const char *profileName(DeviceProfile profile) {
+  switch (profile) {
+  case PROFILE_GAS_F32:
+    return "gas-f32";
+  case PROFILE_GAS_U16:
+    return "gas-u16";
+  case PROFILE_PM:
+    return "pm";
+  case PROFILE_TEMP_RH:
+    return "t-rh";
+  case PROFILE_BRIDGE_GAS:
+    return "gas";
+  case PROFILE_BRIDGE_GAS_SPLIT:
+    return "gas-split";
+  case PROFILE_BRIDGE_PM:
+    return "pm";
+  case PROFILE_UNKNOWN:
+    return "?";
+  default:
+    return "-";
+  }
+}
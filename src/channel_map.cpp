@@ -0,0 +1,101 @@
+#include "channel_map.h"
+#include "bridge_client.h"
+#include "bus_topology.h"
+#include "modbus_crc.h"
+#include "serial.h"
+#include <EEPROM.h>
+
+constexpr uint8_t CHANNEL_MAP_VERSION = 1;
+
+// EEPROM image; crc covers version and words.
+struct ChannelMapRecord {
+  uint8_t version;
+  uint16_t words[MAX_DEVICE_ID + 1];
+  uint16_t crc;
+};
+static_assert(EEPROM_CHANNEL_MAP_ADDR + sizeof(ChannelMapRecord) <=
+                  EEPROM_LOG_ADDR,
+              "channel map record runs into the minute log");
+
+static uint16_t channel_map[MAX_DEVICE_ID + 1];
+
+static uint16_t recordCrc(const ChannelMapRecord &rec);
+
+void channelMapLoad() {
+  ChannelMapRecord rec;
+  EEPROM.get(EEPROM_CHANNEL_MAP_ADDR, rec);
+  if (rec.version == CHANNEL_MAP_VERSION && rec.crc == recordCrc(rec)) {
+    memcpy(channel_map, rec.words, sizeof(channel_map));
+    logLine("Channel map: loaded from EEPROM", true);
+    return;
+  }
+  memset(channel_map, 0, sizeof(channel_map));
+  for (uint8_t i = 0; i < DEFAULT_CHANNEL_MAP_CNT; ++i)
+    channel_map[DEFAULT_CHANNEL_MAP[i].id] = DEFAULT_CHANNEL_MAP[i].word;
+  logLine("Channel map: defaults", true);
+}
+
+void channelMapSave() {
+  ChannelMapRecord rec;
+  rec.version = CHANNEL_MAP_VERSION;
+  memcpy(rec.words, channel_map, sizeof(rec.words));
+  rec.crc = recordCrc(rec);
+  EEPROM.put(EEPROM_CHANNEL_MAP_ADDR, rec); // update(): unchanged cells kept
+}
+
+bool channelMapValid(uint8_t id, uint16_t word) {
+  if (id == 0 || id > MAX_DEVICE_ID || id == UNIT_ID)
+    return false;
+  DeviceProfile p = (DeviceProfile)(word >> 12);
+  if (p == PROFILE_UNKNOWN || p >= PROFILE_COUNT)
+    return false;
+  if (p != PROFILE_NONE && profileIsBridged(p) != (bridgeFor(id) != nullptr))
+    return false;
+  for (uint8_t k = 0; k < MAP_VALUES; ++k) {
+    uint8_t ch = (word >> (k * 4)) & 0x0F;
+    if (ch == MAP_NO_CHANNEL)
+      continue;
+    if (ch >= CH_COUNT || !(POLLED_CHANNELS & chBit((ChannelIndex)ch)))
+      return false;
+    if (p != PROFILE_NONE && k >= profileValues(p))
+      return false;
+  }
+  return true;
+}
+
+void channelMapSet(uint8_t id, uint16_t word) {
+  bool repin = (word >> 12) != (channel_map[id] >> 12);
+  channel_map[id] = word;
+  logLine("Channel map: id ", false);
+  logLine(id, false);
+  logLine(" = 0x", false);
+  logLine(word, HEX, true);
+  if (repin)
+    topologyForget(id);
+}
+
+uint16_t channelMapWordOf(uint8_t id) {
+  return id <= MAX_DEVICE_ID ? channel_map[id] : 0;
+}
+
+DeviceProfile channelMapProfile(uint8_t id) {
+  return (DeviceProfile)(channelMapWordOf(id) >> 12);
+}
+
+uint8_t channelMapChannel(uint8_t id, uint8_t k) {
+  if (k >= MAP_VALUES)
+    return MAP_NO_CHANNEL;
+  return (channelMapWordOf(id) >> (k * 4)) & 0x0F;
+}
+
+bool channelMapAny(uint8_t id) {
+  for (uint8_t k = 0; k < MAP_VALUES; ++k)
+    if (channelMapChannel(id, k) != MAP_NO_CHANNEL)
+      return true;
+  return false;
+}
+
+static uint16_t recordCrc(const ChannelMapRecord &rec) {
+  return crc16_modbus(reinterpret_cast<const uint8_t *>(&rec),
+                      offsetof(ChannelMapRecord, crc));
+}
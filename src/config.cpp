@@ -1,39 +1,91 @@
 #include "config.h"
 
 double send_arr[SEND_ARR_SIZE] = {0};
-float sensors_dec[9] = {0};  // [CO, SO2, NO2, NO, H2S, O3, NH3, PM_2.5, PM_10]
-float radiation_uSvh = 0.0f; // radiation
-float service_t[2] = {0};    // temperature, dampness
+int32_t channel_fx[CH_COUNT] = {0};
+uint16_t stale_channels = POLLED_CHANNELS;
+uint16_t cycle_stale_channels = POLLED_CHANNELS;
 
-const size_t sensors_dec_cnt = ARRLEN(sensors_dec);
-const size_t service_t_cnt = ARRLEN(service_t);
+uint16_t station_settings[SETTINGS_COUNT] = {
+    MONITOR_TIME_SLEEP, BDBG_TIME_SLEEP / SEC, UPLOAD_RETRY_SLEEP / SEC};
+const SettingLimits SETTING_LIMITS[SETTINGS_COUNT] = {
+    {500, 10000}, // SET_MONITOR_MS
+    {5, 600},     // SET_BDBG_S
+    {10, 3600},   // SET_UPLOAD_RETRY_S
+};
 // ---------- Sensor Box (Modbus RTU) ----------
 bool active_ids[6] = {false, false, false, false, false, false};
 
 const uint8_t PRIMARY_IDS[] = {2, 4, 6, 7};
 const uint8_t PRIMARY_COUNT = ARRLEN(PRIMARY_IDS);
 
-const uint8_t EXTRA_IF_ONLY2[] = {2, 5};
-const uint8_t EXTRA_IF_ONLY4[] = {4, 3, 8, 9};
-const uint8_t EXTRA_IF_ONLY6[] = {6, 5, 10};
-const uint8_t EXTRA_IF_ONLY7[] = {7, 5, 10};
-
-const uint8_t EXTRA_ONLY2_CNT = ARRLEN(EXTRA_IF_ONLY2);
-const uint8_t EXTRA_ONLY4_CNT = ARRLEN(EXTRA_IF_ONLY4);
-const uint8_t EXTRA_ONLY6_CNT = ARRLEN(EXTRA_IF_ONLY6);
-const uint8_t EXTRA_ONLY7_CNT = ARRLEN(EXTRA_IF_ONLY7);
-
 const IPAddress ip_3(192, 168, 88, 3);
 const IPAddress ip_4(192, 168, 88, 4);
 const IPAddress ip_8(192, 168, 88, 8);
 const IPAddress ip_9(192, 168, 88, 9);
 
+static_assert(GAS_REG_COUNT <= RS485_MAX_READ_REGS &&
+                  GAS_REG_COUNT2 <= RS485_MAX_READ_REGS &&
+                  PM_REG_COUNT <= RS485_MAX_READ_REGS,
+              "RS-485 reply buffer too small for the register maps");
+
+// Every probe is tried on a unit whose profile is not pinned by the
+// channel map; more than one matching signature leaves it unknown.
+const ProfileProbe RTU_PROBES[] = {
+    {PROFILE_GAS_F32, {GAS_START_ADDR, GAS_REG_COUNT}},
+    {PROFILE_PM, {PM_START_ADDR, PM_REG_COUNT}},
+    {PROFILE_GAS_U16, {GAS_START_ADDR2, GAS_REG_COUNT2}},
+    {PROFILE_TEMP_RH, {0x0000, 2}},
+};
+const uint8_t RTU_PROBES_CNT = ARRLEN(RTU_PROBES);
+
+const ProfileProbe BRIDGE_PROBES[] = {
+    {PROFILE_BRIDGE_GAS, {BRIDGE_GAS_ADDR, 2}},
+    {PROFILE_BRIDGE_PM, {0x0000, 2}},
+    {PROFILE_BRIDGE_GAS_SPLIT, {0x00B8, 2}},
+};
+const uint8_t BRIDGE_PROBES_CNT = ARRLEN(BRIDGE_PROBES);
+
+// A gateway that speaks Modbus TCP is switched over with
+// {id, ip, BRIDGE_MODBUS_TCP, MBTCP_PORT}; its reads are then pipelined.
+// Datagram gateways use BRIDGE_RTU_UDP / BRIDGE_MODBUS_UDP and their UDP
+// port.
+const BridgeEndpoint BRIDGES[] = {
+    {3, ip_3, BRIDGE_RTU_TCP, port},
+    {4, ip_4, BRIDGE_RTU_TCP, port},
+    {8, ip_8, BRIDGE_RTU_TCP, port},
+    {9, ip_9, BRIDGE_RTU_TCP, port},
+};
+const uint8_t BRIDGES_CNT = ARRLEN(BRIDGES);
+
+const DeviceReadLimit READ_LIMITS[] = {
+    {8, 16},
+};
+const uint8_t READ_LIMITS_CNT = ARRLEN(READ_LIMITS);
+
+const RegSpan BRIDGE_SPLIT_SPANS[] = {
+    {BRIDGE_GAS_ADDR, 2}, {BRIDGE_GAS_ADDR + 2, 2}, {0x00B8, 2}};
+const uint8_t BRIDGE_SPLIT_SPANS_CNT = ARRLEN(BRIDGE_SPLIT_SPANS);
+static_assert(ARRLEN(BRIDGE_SPLIT_SPANS) == MAP_VALUES,
+              "one span per split gas value");
+
+const ChannelMapDefault DEFAULT_CHANNEL_MAP[] = {
+    {2, channelMapWord(PROFILE_GAS_U16, CH_CO, CH_SO2, CH_NO2)},
+    {3, channelMapWord(PROFILE_BRIDGE_GAS, CH_SO2, CH_H2S)},
+    {4, channelMapWord(PROFILE_BRIDGE_GAS, CH_CO)},
+    {5, channelMapWord(PROFILE_GAS_F32, CH_CO, CH_SO2, CH_NO2)},
+    {6, channelMapWord(PROFILE_GAS_F32, CH_NO, CH_H2S, CH_O3)},
+    {7, channelMapWord(PROFILE_GAS_F32, CH_NH3, CH_H2S, CH_O3)},
+    {8, channelMapWord(PROFILE_BRIDGE_GAS_SPLIT, CH_NO, CH_NO2, CH_NH3)},
+    {9, channelMapWord(PROFILE_BRIDGE_PM, CH_PM2_5, CH_PM10)},
+    {PM_ID, channelMapWord(PROFILE_PM, CH_PM2_5, CH_PM10)},
+    {TEMP_RH_ID, channelMapWord(PROFILE_TEMP_RH, CH_S_RH, CH_S_T)},
+};
+const uint8_t DEFAULT_CHANNEL_MAP_CNT = ARRLEN(DEFAULT_CHANNEL_MAP);
+
 const byte MAC_ADDR[] = {0x02, 0x11, 0x22, 0x00, 0x00, 0x01};
 const IPAddress STATIC_IP(192, 168, 88, 2);
 const IPAddress GETWAY(192, 168, 88, 1);
 
-uint8_t resp[256];
-
 // Allow overriding via PlatformIO build flags.
 const char SERVER_IP[] = SERVER_IP_VALUE;
 const char API_KEY[] = API_KEY_VALUE;
@@ -0,0 +1,152 @@
+#include "device_health.h"
+#include "serial.h"
+
+// Jacobson/Karels estimator in fixed point: srtt * 8, rttvar * 4.
+struct RttState {
+  uint16_t srtt_x8;
+  uint16_t rttvar_x4;
+  uint8_t backoff;
+  bool has_rtt;
+};
+
+struct BreakerState {
+  uint32_t next_probe_ms;
+  uint32_t backoff_ms;
+  uint32_t fail_cost_ms; // duration of the last failed poll
+};
+
+static RttState rtt_state[MAX_DEVICE_ID + 1];
+static BreakerState breaker[MAX_DEVICE_ID + 1];
+static DeviceHealthStats stats[MAX_DEVICE_ID + 1];
+
+void deviceRecordRtt(uint8_t id, uint16_t rtt_ms) {
+  if (id > MAX_DEVICE_ID)
+    return;
+  RttState &st = rtt_state[id];
+  if (rtt_ms > 4000)
+    rtt_ms = 4000;
+
+  if (!st.has_rtt) {
+    st.srtt_x8 = rtt_ms << 3;
+    st.rttvar_x4 = rtt_ms << 1; // rttvar = rtt / 2
+    st.has_rtt = true;
+  } else {
+    int16_t err = (int16_t)rtt_ms - (int16_t)(st.srtt_x8 >> 3);
+    st.srtt_x8 += err; // srtt += err / 8
+    if (err < 0)
+      err = -err;
+    st.rttvar_x4 += err - (int16_t)(st.rttvar_x4 >> 2); // rttvar += (|err| - rttvar) / 4
+  }
+  st.backoff = 0;
+}
+
+void deviceRecordTimeout(uint8_t id) {
+  if (id > MAX_DEVICE_ID)
+    return;
+  if (rtt_state[id].backoff < RTT_MAX_BACKOFF)
+    rtt_state[id].backoff++;
+}
+
+uint16_t deviceTimeoutMs(uint8_t id, const TimeoutLimits &limits) {
+  uint32_t rto = limits.initialMs;
+  uint8_t backoff = 0;
+  if (id <= MAX_DEVICE_ID) {
+    const RttState &st = rtt_state[id];
+    if (st.has_rtt)
+      rto = (st.srtt_x8 >> 3) + st.rttvar_x4;
+    backoff = st.backoff;
+  }
+  rto <<= backoff;
+  if (rto < limits.minMs)
+    rto = limits.minMs;
+  if (rto > limits.maxMs)
+    rto = limits.maxMs;
+  return (uint16_t)rto;
+}
+
+bool deviceShouldPoll(uint8_t id) {
+  if (id > MAX_DEVICE_ID)
+    return true;
+  DeviceHealthStats &st = stats[id];
+  if (st.state != DEV_OPEN)
+    return true;
+
+  BreakerState &br = breaker[id];
+  if ((int32_t)(millis() - br.next_probe_ms) >= 0) {
+    st.trials++; // half-open: let one read through
+    return true;
+  }
+  st.skipped++;
+  st.saved_ms += br.fail_cost_ms;
+  return false;
+}
+
+void deviceReportPoll(uint8_t id, bool ok, uint32_t elapsed_ms) {
+  if (id > MAX_DEVICE_ID)
+    return;
+  DeviceHealthStats &st = stats[id];
+  BreakerState &br = breaker[id];
+
+  if (ok) {
+    if (st.state == DEV_OPEN) {
+      logLine("Breaker closed for ID ", false);
+      logLine(id, true);
+    }
+    st.state = DEV_HEALTHY;
+    st.failures = 0;
+    br.backoff_ms = 0;
+    return;
+  }
+
+  br.fail_cost_ms = elapsed_ms;
+  if (st.failures < 0xFF)
+    st.failures++;
+
+  if (st.state == DEV_OPEN) {
+    // Failed trial read: wait twice as long before the next one.
+    br.backoff_ms *= 2;
+    if (br.backoff_ms > BREAKER_BACKOFF_MAX)
+      br.backoff_ms = BREAKER_BACKOFF_MAX;
+  } else if (st.failures >= BREAKER_OPEN_AFTER) {
+    st.state = DEV_OPEN;
+    br.backoff_ms = BREAKER_BACKOFF_MIN;
+    logLine("Breaker open for ID ", false);
+    logLine(id, true);
+  } else {
+    st.state = DEV_SUSPECT;
+    return;
+  }
+  br.next_probe_ms = millis() + br.backoff_ms;
+}
+
+const DeviceHealthStats &deviceStats(uint8_t id) {
+  static const DeviceHealthStats none = {DEV_HEALTHY, 0, 0, 0, 0};
+  return (id <= MAX_DEVICE_ID) ? stats[id] : none;
+}
+
+void deviceLogHealth() {
+  static const char *const names[] = {"OK", "SUSPECT", "OPEN"};
+  uint32_t saved = 0;
+  for (uint8_t id = 0; id <= MAX_DEVICE_ID; ++id) {
+    const DeviceHealthStats &st = stats[id];
+    saved += st.saved_ms;
+    if (st.state == DEV_HEALTHY && st.skipped == 0)
+      continue;
+    logLine("ID", false);
+    logLine(id, false);
+    logLine(": ", false);
+    logLine(names[st.state], false);
+    logLine(" fail=", false);
+    logLine(st.failures, false);
+    logLine(" skip=", false);
+    logLine(st.skipped, false);
+    logLine(" trial=", false);
+    logLine(st.trials, false);
+    logLine(" saved=", false);
+    logLine(st.saved_ms, false);
+    logLine(" ms", true);
+  }
+  logLine("Breaker saved total: ", false);
+  logLine(saved, false);
+  logLine(" ms", true);
+}
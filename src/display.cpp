@@ -1,11 +1,13 @@
 #include "display.h"
+#include "bus_topology.h"
 #include "config.h"
+#include "sensor_box.h"
 #include "utils.h"
 #include "serial.h"
 
 TFT_eSPI tft;
 
-static const uint8_t *ids = nullptr;
+static uint8_t ids[6] = {0}; // polled IDs in active_ids order
 static size_t ids_len = 0;
 static bool no_repeate_active_ids[6] = {false, false, false,
                                         false, false, false};
@@ -40,7 +42,7 @@ void drawValue(bool &alive1, bool &alive2, bool &alive3, bool &alive4) {
     return;
 
   drawOnlyValue();
-  if (!ids) {
+  if (!ids_len) {
     drawWorkIds(alive1, alive2, alive3, alive4);
     return;
   }
@@ -110,26 +112,16 @@ static void drawWorkIds(bool &alive1, bool &alive2, bool &alive3,
   const int bar_h = 20;
   const int bar_w = 60;
 
-  if (alive1) {
-    ids = EXTRA_IF_ONLY2;
-    ids_len = EXTRA_ONLY2_CNT;
-  } else if (alive2) {
-    ids = EXTRA_IF_ONLY4;
-    ids_len = EXTRA_ONLY4_CNT;
-  } else if (alive3) {
-    ids = EXTRA_IF_ONLY6;
-    ids_len = EXTRA_ONLY6_CNT;
-  } else if (alive4) {
-    ids = EXTRA_IF_ONLY7;
-    ids_len = EXTRA_ONLY7_CNT;
-  } else {
-    ids = nullptr;
-    ids_len = 0;
-  }
+  // Same order as the poll loop in sensor_box
+  ids_len = 0;
+  if (alive1 || alive2 || alive3 || alive4)
+    for (uint8_t id = 1; id <= MAX_DEVICE_ID && ids_len < ARRLEN(ids); ++id)
+      if (sensorHasSlot(id))
+        ids[ids_len++] = id;
   tft.fillRect(62, h - bar_h*2, w, bar_h, TFT_BLACK);
 
   tft.drawString("ID |", 2, h - bar_h * 2);
-  if (ids == nullptr && ids_len == 0) {
+  if (ids_len == 0) {
     tft.drawString("NO ANSWER", 62, h - bar_h * 2);
   }
 
@@ -142,7 +134,7 @@ static void drawWorkIds(bool &alive1, bool &alive2, bool &alive3,
 }
 
 void drawOnlyValuesIds() {
-  if (!ids) return;
+  if (!ids_len) return;
   const int h = tft.height();
   const int bar_h = 20;
   const int bar_w = 60;
@@ -1,24 +1,28 @@
 #include "eth_manager.h"
 #include "config.h"
+#include "frame_pool.h"
+#include "minute_log.h"
 #include "utils.h"
 #include "serial.h"
 
 EthernetServer modbus_server(MODBUS_TCP_PORT);
 EthernetServer serial_server(SERIAL_TCP_PORT);
 
+static bool upload_failing = false;
+static uint32_t upload_failed_ms = 0;
+
 static inline bool mac_valid(const uint8_t *m);
 static String macToStringLocal(const uint8_t mac[6]);
 static bool loadMacFromEeprom(uint8_t mac[6]);
-static size_t buildSensorsJson(char *out, size_t maxLen);
+static bool uploadDue();
+static bool uploadDone(bool ok);
+static size_t buildSensorsJson(const MinuteRecord &rec, char *out,
+                               size_t maxLen);
 static bool httpPostBody(EthernetClient &client, const char *hostHeader,
                          const char *path, const char *body, size_t bodyLen,
                          uint16_t timeoutMs = 2000);
 static bool httpPostSensorsImpl(EthernetClient &client, const char *hostHeader,
                                 const char *path, uint16_t timeoutMs = 2000);
-static const char *hwName(uint8_t hs);
-static const char *linkName(uint8_t ls);
-static const char *sockName(uint8_t s);
-static void printEthDiag(EthernetClient &c);
 
 void initEthernet() {
   Ethernet.init(ETH_CS);
@@ -45,26 +49,26 @@ void initEthernet() {
 
 // Public: POST to hostname
 bool httpPostSensors(const char *host, uint16_t port, const char *path) {
-  if (!time_guard_allow(path, SEND_DATA_TIME_SLEEP))
+  if (!uploadDue())
     return false;
 
   EthernetClient client;
   if (!client.connect(host, port)) {
     logLine(F("HTTP POST connect(host) failed"), true);
-    return false;
+    return uploadDone(false);
   }
   return httpPostSensorsImpl(client, host, path);
 }
 
 // Public: POST to IP address
 bool httpPostSensors(const IPAddress &ip, uint16_t port, const char *path) {
-  if (!time_guard_allow(path, SEND_DATA_TIME_SLEEP))
+  if (!uploadDue())
     return false;
 
   EthernetClient client;
   if (!client.connect(ip, port)) {
     logLine(F("HTTP POST connect(IP) failed"), true);
-    return false;
+    return uploadDone(false);
   }
   // Build Host header from IP (HTTP/1.1 requires Host)
   char hostBuf[24];
@@ -72,40 +76,6 @@ bool httpPostSensors(const IPAddress &ip, uint16_t port, const char *path) {
   return httpPostSensorsImpl(client, hostBuf, path);
 }
 
-bool pingId_Ethernet(const IPAddress &ip, uint16_t port,
-                     uint16_t timeoutMs = 800) {
-  EthernetClient client;
-  logLine(F("Connect "), false);
-  logLine(ip, false);
-  logLine(F(":"), false);
-  logLine(port, true);
-#if defined(ETHERNET_H)
-  if (Ethernet.hardwareStatus() == EthernetNoHardware) {
-    logLine(F("ERROR: No Ethernet hardware"), true);
-  }
-  if (Ethernet.linkStatus() == LinkOFF) {
-    logLine(F("ERROR: LinkOFF"), true);
-  }
-#endif
-  uint32_t t0 = millis();
-  bool ok = client.connect(ip, port);
-  uint32_t dt = millis() - t0;
-  if (!ok) {
-    logLine(F("Connect FAILED in "), false);
-    logLine(dt, false);
-    logLine(F(" ms"), true);
-    printEthDiag(client);
-    client.stop();
-    return false;
-  }
-  logLine(F("Connect OK in "), false);
-  logLine(dt, false);
-  logLine(F(" ms"), true);
-  printEthDiag(client);
-  client.stop();
-  return true;
-}
-
 static inline bool mac_valid(const uint8_t *m) {
   bool allFF = true, all00 = true;
   for (int i = 0; i < 6; ++i) {
@@ -177,7 +147,27 @@ static bool loadMacFromEeprom(uint8_t mac[6]) {
 
 // ============================ HTTP POST helpers ============================
 
-static size_t buildSensorsJson(char *out, size_t maxLen) {
+// One post per call while the minute log has records; after a failure
+// wait SET_UPLOAD_RETRY_S before the next try.
+static bool uploadDue() {
+  if (minuteLogPending() == 0)
+    return false;
+  return !upload_failing ||
+         millis() - upload_failed_ms >=
+             station_settings[SET_UPLOAD_RETRY_S] * SEC;
+}
+
+static bool uploadDone(bool ok) {
+  upload_failing = !ok;
+  if (!ok)
+    upload_failed_ms = millis();
+  return ok;
+}
+
+// Body of one minute record: id, boot/minute that identify it, its age in
+// minutes when it comes from this boot, then the channel values.
+static size_t buildSensorsJson(const MinuteRecord &rec, char *out,
+                               size_t maxLen) {
   size_t values_number = labels_len;
   if (values_number > SEND_ARR_SIZE)
     values_number = SEND_ARR_SIZE;
@@ -209,6 +199,16 @@ static size_t buildSensorsJson(char *out, size_t maxLen) {
   emit(idBuf);
   emit("\"");
 
+  char meta[48];
+  snprintf(meta, sizeof(meta), ",\"boot\":%u,\"minute\":%u", rec.boot,
+           rec.minute);
+  emit(meta);
+  if (rec.boot == minuteLogBoot()) {
+    snprintf(meta, sizeof(meta), ",\"age_min\":%u",
+             (uint16_t)(aggregateInfo().seq - rec.minute));
+    emit(meta);
+  }
+
   bool first = false;
   for (size_t i = 0; i < values_number; ++i) {
     const LabelEntry &spec = labels[i];
@@ -220,7 +220,7 @@ static size_t buildSensorsJson(char *out, size_t maxLen) {
     emit(spec.name);
     emit("\":");
     char num[24];
-    dtostrf(send_arr[i], 0, 3, num);
+    dtostrf(minuteLogValue(rec, spec.channel), 0, 3, num);
     char *p = num;
     while (*p == ' ')
       ++p;
@@ -261,93 +261,32 @@ static bool httpPostBody(EthernetClient &client, const char *hostHeader,
     if (client.available())
       break;
   }
+  // "HTTP/1.1 2xx": only a 2xx status lets the record go
+  char status[12];
   size_t got = 0;
   while (client.available() && got < 256) {
-    (void)client.read();
+    int c = client.read();
+    if (got < sizeof(status))
+      status[got] = (char)c;
     ++got;
   }
   client.stop();
-  return (got > 0); // consider success if any response data arrived
+  return got >= sizeof(status) && status[9] == '2';
 }
 
 static bool httpPostSensorsImpl(EthernetClient &client, const char *hostHeader,
                                 const char *path, uint16_t timeoutMs) {
-  char body[768];
-  size_t bodyLen = buildSensorsJson(body, sizeof(body) - 1);
-  return httpPostBody(client, hostHeader, path, body, bodyLen, timeoutMs);
-}
-
-static const char *hwName(uint8_t hs) {
-  switch (hs) {
-  case EthernetNoHardware:
-    return "NoHardware";
-  case EthernetW5100:
-    return "W5100";
-  case EthernetW5200:
-    return "W5200";
-  case EthernetW5500:
-    return "W5500";
-  default:
-    return "UnknownHW";
-  }
-}
-static const char *linkName(uint8_t ls) {
-  switch (ls) {
-  case LinkON:
-    return "LinkON";
-  case LinkOFF:
-    return "LinkOFF";
-  default:
-    return "LinkUnknown";
-  }
-}
-static const char *sockName(uint8_t s) {
-  switch (s) {
-  case 0x00:
-    return "CLOSED";
-  case 0x13:
-    return "INIT";
-  case 0x14:
-    return "LISTEN";
-  case 0x15:
-    return "SYNSENT";
-  case 0x16:
-    return "SYNRECV";
-  case 0x17:
-    return "ESTABLISHED";
-  case 0x18:
-    return "FIN_WAIT";
-  case 0x1A:
-    return "CLOSING";
-  case 0x1B:
-    return "TIME_WAIT";
-  case 0x1C:
-    return "CLOSE_WAIT";
-  case 0x1D:
-    return "LAST_ACK";
-  default:
-    return "OTHER";
+  MinuteRecord rec;
+  FrameLease frame(HTTP_BODY_SLOTS);
+  if (!frame.ok() || !minuteLogPeek(rec)) {
+    client.stop();
+    return false;
   }
+  char *body = frame.chars();
+  size_t bodyLen = buildSensorsJson(rec, body, frame.size() - 1);
+  if (!uploadDone(httpPostBody(client, hostHeader, path, body, bodyLen,
+                               timeoutMs)))
+    return false;
+  minuteLogMarkSent();
+  return true;
 }
-static void printEthDiag(EthernetClient &c) {
-#if defined(ETHERNET_H)
-  logLine(F("HW="), false);
-  logLine(hwName(Ethernet.hardwareStatus()), false);
-  logLine(F(" LINK="), false);
-  logLine(linkName(Ethernet.linkStatus()), false);
-#endif
-  logLine(F(" Sock=0x"), false);
-  logLine(c.status(), HEX, false);
-  logLine(F(" ("), false);
-  logLine(sockName(c.status()), false);
-  logLine(F(")"), true);
-
-  logLine(F("Local="), false);
-  logLine(Ethernet.localIP(), false);
-  logLine(F(" GW="), false);
-  logLine(Ethernet.gatewayIP(), false);
-  logLine(F(" DNS="), false);
-  logLine(Ethernet.dnsServerIP(), false);
-  logLine(F(" MASK="), false);
-  logLine(Ethernet.subnetMask(), true);
-}
\ No newline at end of file
@@ -0,0 +1,59 @@
+#include "frame_pool.h"
+#include "serial.h"
+
+static_assert(FRAME_POOL_SLOTS <= 8, "slot mask is one byte");
+
+static uint8_t pool[FRAME_POOL_SLOTS][FRAME_SLOT_SIZE];
+static uint8_t used_mask = 0;
+static FramePoolStats stats = {0, 0, 0};
+
+// First run of n free slots, FRAME_POOL_SLOTS if none.
+static uint8_t findRun(uint8_t n) {
+  uint8_t want = (uint8_t)((1u << n) - 1);
+  for (uint8_t i = 0; i + n <= FRAME_POOL_SLOTS; ++i)
+    if ((used_mask & (want << i)) == 0)
+      return i;
+  return FRAME_POOL_SLOTS;
+}
+
+FrameLease::FrameLease(uint8_t slots) : buf_(nullptr), slots_(0) {
+  if (slots == 0 || slots > FRAME_POOL_SLOTS) {
+    stats.refused++;
+    return;
+  }
+  uint8_t first = findRun(slots);
+  if (first == FRAME_POOL_SLOTS) {
+    stats.refused++;
+    logLine("Frame pool exhausted", true);
+    return;
+  }
+  used_mask |= (uint8_t)(((1u << slots) - 1) << first);
+  buf_ = pool[first];
+  slots_ = slots;
+  stats.inUse += slots;
+  if (stats.inUse > stats.peak)
+    stats.peak = stats.inUse;
+}
+
+FrameLease::~FrameLease() {
+  if (buf_ == nullptr)
+    return;
+  uint8_t first = (uint8_t)((buf_ - pool[0]) / FRAME_SLOT_SIZE);
+  used_mask &= (uint8_t)~(((1u << slots_) - 1) << first);
+  stats.inUse -= slots_;
+}
+
+const FramePoolStats &framePoolStats() { return stats; }
+
+void framePoolLog() {
+  logLine("Frame pool: ", false);
+  logLine(FRAME_POOL_SLOTS, false);
+  logLine(" x ", false);
+  logLine(FRAME_SLOT_SIZE, false);
+  logLine(" B, in use ", false);
+  logLine(stats.inUse, false);
+  logLine(", peak ", false);
+  logLine(stats.peak, false);
+  logLine(", refused ", false);
+  logLine(stats.refused, true);
+}
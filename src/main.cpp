@@ -11,13 +11,20 @@
 */
 
 #include "bdbg.h"
+#include "bus_topology.h"
+#include "channel_map.h"
 #include "config.h"
 #include "display.h"
 #include "eth_manager.h"
+#include "minute_log.h"
 #include "modbus.h"
+#include "modbus_crc.h"
+#include "register_image.h"
 #include "relay.h"
+#include "rs485_bus.h"
 #include "sensor_box.h"
 #include "serial.h"
+#include "sram_watch.h"
 #include "utils.h"
 
 bool alive2 = false, alive4 = false, alive6 = false, alive7 = false;
@@ -26,7 +33,9 @@ static void initSerials();
 static void pollMonitoringData();
 
 void setup() {
+  sramPaint();
   fill(send_arr, SEND_ARR_SIZE, DEFAULT_SEND_VAL);
+  registerImagePublish();
 
   initDisplay();
   Serial.begin(SERIAL0_BAUD);
@@ -38,15 +47,23 @@ void setup() {
   logLine(SERVER_IP, true);
 
   initSerials();
-
-  pinMode(RS485_DIR_PIN, OUTPUT);
+#ifdef MODBUS_CRC_BENCH
+  modbusCrcBenchmark();
+#endif
+#ifdef FIXED_POINT_BENCH
+  fixedPointBenchmark();
+#endif
+
+  rs485Init();
   pinMode(BDBG_DIR_PIN, OUTPUT);
   digitalWrite(BDBG_DIR_PIN, LOW);
 
-  sensor_box.preTransmission(pre_transmission_main);
-  sensor_box.postTransmission(post_transmission_main);
-
   initEthernet();
+  // Known wiring starts polling at once; a first boot scans the bus.
+  minuteLogInit();
+  channelMapLoad();
+  if (!topologyLoad())
+    topologyDiscover();
   initRelayHttp();
   logLine("Finsh Initialization", true);
 }
@@ -54,6 +71,7 @@ void loop() {
   uint32_t t1 = millis();
 
   TIME_CALL("Monitoring Data", pollMonitoringData());
+  TIME_CALL("RS485 bus", rs485Service());
   TIME_CALL("Modbus connect", modbusTcpServiceOnce());
   TIME_CALL("Serial Server", streamLogData());
   TIME_CALL("Drawing value on arduino",
@@ -75,21 +93,24 @@ void loop() {
 static void initSerials() {
   Serial2.begin(SERIAL2_BAUD); // BDBG 8N1
   Serial2.setTimeout(10);
-
-  Serial3.begin(SERIAL3_BAUD); // Sensor Box 8E1
-  Serial3.setTimeout(10);
+  // Serial3 (Sensor Box) is owned by rs485_bus, see rs485Init()
 }
 
 static void pollMonitoringData() {
-  if (!time_guard_allow("monitoring", MONITOR_TIME_SLEEP))
+  if (!time_guard_allow("monitoring", station_settings[SET_MONITOR_MS]))
     return;
 
+  // Sample the cycle that just finished before queueing the next one:
+  // RS-485 replies arrive asynchronously between ticks.
+  collectAndAverageEveryMinute();
+
+  topologyService();
   poll_SensorBox_SensorZTS3008(alive2, alive4, alive6, alive7);
 
   if (!alive4) {
     pollRadiation();
   }
 
-  collectAndAverageEveryMinute();
+  registerImagePublishInput();
   drawOnlyValuesIds();
 }
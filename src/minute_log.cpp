@@ -0,0 +1,176 @@
+#include "minute_log.h"
+#include "modbus_crc.h"
+#include "utils.h"
+#include "serial.h"
+#include <EEPROM.h>
+
+constexpr uint8_t LOG_PENDING = 0xFF; // erased EEPROM reads as pending too
+constexpr uint8_t LOG_SENT = 0x00;
+
+// EEPROM image of one record; crc covers boot..values. sent sits outside
+// the crc so uploading costs a single byte write.
+struct LogSlot {
+  uint8_t sent;
+  uint8_t boot;
+  uint16_t wseq; // write sequence across boots, newest = highest (mod 2^16)
+  uint16_t minute;
+  int16_t values[CH_COUNT];
+  uint16_t crc;
+};
+
+constexpr uint8_t LOG_SLOTS =
+    (EEPROM_LOG_END - EEPROM_LOG_ADDR) / sizeof(LogSlot);
+static_assert(LOG_SLOTS >= 2, "EEPROM log area too small");
+
+static uint8_t head = 0;     // next slot to write
+static uint8_t tail = 0;     // oldest slot that may still be pending
+static uint8_t queued = 0;   // slots from tail up to head
+static uint16_t next_wseq = 0;
+static uint8_t boot = 0;
+static uint16_t overwritten = 0;
+
+static int addrOf(uint8_t slot);
+static bool readSlot(uint8_t slot, LogSlot &s);
+static uint16_t slotCrc(const LogSlot &s);
+static int32_t logDiv(ChannelIndex ch);
+static int16_t toLogUnits(ChannelIndex ch, int32_t fx);
+
+void minuteLogInit() {
+  bool any = false;
+  uint8_t newest = 0;
+  LogSlot s;
+  for (uint8_t i = 0; i < LOG_SLOTS; ++i) {
+    if (!readSlot(i, s))
+      continue;
+    if (!any || (int16_t)(s.wseq - next_wseq) > 0) {
+      any = true;
+      newest = i;
+      next_wseq = s.wseq;
+      boot = s.boot;
+    }
+  }
+  head = any ? (newest + 1) % LOG_SLOTS : 0;
+  next_wseq = any ? next_wseq + 1 : 0;
+  boot = any ? boot + 1 : 0;
+
+  // Walk from the oldest slot up to the newest for the first pending one
+  tail = head;
+  queued = 0;
+  overwritten = 0;
+  for (uint8_t k = 0; k < LOG_SLOTS && any; ++k) {
+    uint8_t i = (head + k) % LOG_SLOTS;
+    if (readSlot(i, s) && s.sent == LOG_PENDING) {
+      tail = i;
+      queued = LOG_SLOTS - k;
+      break;
+    }
+  }
+  logLine("Minute log: boot ", false);
+  logLine(boot, false);
+  logLine(", pending ", false);
+  logLine(queued, false);
+  logLine(" of ", false);
+  logLine(LOG_SLOTS, true);
+}
+
+void minuteLogAppend() {
+  LogSlot s;
+  s.sent = LOG_PENDING;
+  s.boot = boot;
+  s.wseq = next_wseq++;
+  s.minute = (uint16_t)aggregateInfo().seq;
+  for (uint8_t i = 0; i < CH_COUNT; ++i) {
+    ChannelIndex ch = (ChannelIndex)i;
+    s.values[i] = INT16_MIN;
+    if (ch == CH_R) {
+      // Radiation is sent live, not averaged
+      if (channelSampleMs(CH_R) != 0)
+        s.values[i] = toLogUnits(ch, channel_fx[CH_R]);
+    } else if (aggregateInfo().samples[ch] != 0) {
+      s.values[i] = toLogUnits(ch, minuteStats(ch).mean);
+    }
+  }
+  s.crc = slotCrc(s);
+
+  if (queued == LOG_SLOTS) {
+    tail = (tail + 1) % LOG_SLOTS; // full: the oldest record goes
+    if (overwritten < 0xFFFF)
+      overwritten++;
+    logLine("Minute log full, oldest record dropped: ", false);
+    logLine(overwritten, true);
+  } else {
+    queued++;
+  }
+  EEPROM.put(addrOf(head), s); // crc last: a torn write fails the check
+  head = (head + 1) % LOG_SLOTS;
+}
+
+uint16_t minuteLogPending() { return queued; }
+
+uint8_t minuteLogCapacity() { return LOG_SLOTS; }
+
+uint16_t minuteLogOverwritten() { return overwritten; }
+
+uint8_t minuteLogBoot() { return boot; }
+
+bool minuteLogPeek(MinuteRecord &rec) {
+  LogSlot s;
+  while (queued > 0) {
+    if (readSlot(tail, s) && s.sent == LOG_PENDING) {
+      rec.boot = s.boot;
+      rec.minute = s.minute;
+      memcpy(rec.values, s.values, sizeof(rec.values));
+      return true;
+    }
+    tail = (tail + 1) % LOG_SLOTS; // torn or already sent
+    queued--;
+  }
+  return false;
+}
+
+void minuteLogMarkSent() {
+  if (queued == 0)
+    return;
+  EEPROM.update(addrOf(tail), LOG_SENT);
+  tail = (tail + 1) % LOG_SLOTS;
+  queued--;
+}
+
+float minuteLogValue(const MinuteRecord &rec, ChannelIndex ch) {
+  if (rec.values[ch] == INT16_MIN)
+    return DEFAULT_SEND_VAL;
+  return fxToFloat(ch, rec.values[ch] * logDiv(ch));
+}
+
+static int addrOf(uint8_t slot) {
+  return EEPROM_LOG_ADDR + (int)slot * sizeof(LogSlot);
+}
+
+static bool readSlot(uint8_t slot, LogSlot &s) {
+  EEPROM.get(addrOf(slot), s);
+  return s.crc == slotCrc(s);
+}
+
+static uint16_t slotCrc(const LogSlot &s) {
+  return crc16_modbus(reinterpret_cast<const uint8_t *>(&s) +
+                          offsetof(LogSlot, boot),
+                      offsetof(LogSlot, crc) - offsetof(LogSlot, boot));
+}
+
+// Log units: 0.01 ppm for CO, 0.001 ppm for the other gases, 0.001 mg/m3
+// for PM and the channel step (0.01) for radiation, T and RH.
+static int32_t logDiv(ChannelIndex ch) {
+  if (ch == CH_CO)
+    return 100;
+  return ch < CH_PM2_5 ? 10 : 1;
+}
+
+static int16_t toLogUnits(ChannelIndex ch, int32_t fx) {
+  int32_t div = logDiv(ch);
+  int32_t v = (fx + (fx < 0 ? -div / 2 : div / 2)) / div;
+  if (v > INT16_MAX)
+    return INT16_MAX;
+  if (v <= INT16_MIN)
+    return INT16_MIN + 1;
+  return v;
+}
@@ -1,94 +1,485 @@
 #include "modbus.h"
+#include "bus_topology.h"
+#include "channel_map.h"
 #include "config.h"
 #include "eth_manager.h"
+#include "frame_pool.h"
+#include "register_image.h"
+#include "relay.h"
+#include "rs485_bus.h"
+#include "serial.h"
 
-static void modbusTcpHandleRequest(EthernetClient &client,
-                                   const uint8_t *request, size_t n);
+enum GatewayState : uint8_t {
+  GW_IDLE,
+  GW_WAITING, // parsed, waiting for the rate limit
+  GW_ON_BUS,  // queued on RS-485, reply arrives in onGatewayReply()
+};
 
-static EthernetClient client;
+// One accepted master. Bytes collect in rx and are cut into requests by
+// the MBAP length field, so a request split over several segments waits
+// for its tail and several requests in one segment are all answered.
+struct MbConnection {
+  EthernetClient client;
+  uint32_t lastRx;
+  uint16_t skip; // bytes left of a request too long for rx
+  uint8_t rxLen;
+  uint8_t rx[MB_CLIENT_RX_BUF];
+};
 
+// The one request being forwarded to a Serial3 device or the relay. Relay
+// writes go through relayWriteChannel(), FC15 as one FC5 write per coil.
+struct GatewayRequest {
+  GatewayState state;
+  MbConnection *conn; // nullptr once the master has gone away
+  uint8_t mbap[4];    // transaction + protocol ID echoed back
+  uint8_t head[6];    // unit, FC, address, count of the original request
+  uint8_t coilNext;   // FC5/FC15: next coil to write
+  uint8_t coilBits;   // FC5/FC15: requested states, bit 0 = first coil
+  Rs485Request req;
+};
+
+static void acceptClients();
+static void serviceConnection(MbConnection &c);
+static void closeConnection(MbConnection &c);
+static bool modbusTcpHandleRequest(MbConnection &c, const uint8_t *request,
+                                   size_t n);
+static bool serveRegisters(MbConnection &c, const uint8_t *request);
+static bool writeSettings(MbConnection &c, const uint8_t *request, size_t n);
+static bool settingValid(uint16_t set, uint16_t v);
+static bool relayRequest(MbConnection &c, const uint8_t *request, size_t n);
+static bool gatewayRoutes(uint8_t unit);
+static bool gatewayQueue(MbConnection &c, const uint8_t *request);
+static bool gatewayStart(MbConnection &c, const uint8_t *request,
+                         Rs485Priority priority,
+                         const TimeoutLimits *limits);
+static void relayCoilStep();
+static void gatewayService();
+static void onGatewayReply(void *ctx, const Rs485Result &res);
+static void writeReply(EthernetClient &client, const uint8_t *mbap,
+                       uint8_t unit, uint8_t *adu, uint8_t pduLen);
+static void writeException(EthernetClient &client, const uint8_t *mbap,
+                           uint8_t unit, uint8_t func, uint8_t code);
+
+static MbConnection conns[MB_MAX_CLIENTS];
+static uint8_t rr_next = 0; // connection served first in this pass
+static GatewayRequest gw;
+static uint32_t gw_last_ms = 0;
+
+// Every connection gets the requests it has buffered answered in order,
+// starting from a different connection each pass.
 void modbusTcpServiceOnce() {
-  if (client && !client.connected()){
-    client.stop();
-  }
-  
-  if (!client || !client.connected()){
-    client = modbus_server.available();
+  acceptClients();
+  gatewayService();
+  for (uint8_t k = 0; k < MB_MAX_CLIENTS; ++k)
+    serviceConnection(conns[(rr_next + k) % MB_MAX_CLIENTS]);
+  rr_next = (rr_next + 1) % MB_MAX_CLIENTS;
+}
+
+static void acceptClients() {
+  EthernetClient fresh = modbus_server.accept();
+  if (!fresh)
+    return;
+  for (uint8_t i = 0; i < MB_MAX_CLIENTS; ++i) {
+    if (conns[i].client)
+      continue;
+    conns[i].client = fresh;
+    conns[i].lastRx = millis();
+    conns[i].rxLen = 0;
+    conns[i].skip = 0;
+    logLine("Modbus TCP client ", false);
+    logLine(fresh.remoteIP(), false);
+    logLine(" -> slot ", false);
+    logLine(i, true);
+    return;
   }
+  logLine("Modbus TCP: no free slot, refused ", false);
+  logLine(fresh.remoteIP(), true);
+  fresh.stop();
+}
 
-  if (!client || !client.connected())
+static void serviceConnection(MbConnection &c) {
+  if (!c.client)
+    return;
+  if (!c.client.connected() || millis() - c.lastRx > MB_CLIENT_IDLE_MS) {
+    closeConnection(c);
+    return;
+  }
+  // Replies go out in request order: wait for a forwarded one first.
+  if (gw.state != GW_IDLE && gw.conn == &c)
     return;
 
-  if (client.available() >= 12) {
-    uint8_t req[260];
-    size_t n = client.read(req, sizeof(req));
-    modbusTcpHandleRequest(client, req, n);
-    client.flush();
+  while (c.skip > 0 && c.client.available()) {
+    c.client.read();
+    --c.skip;
+  }
+  int avail = c.client.available();
+  if (c.skip == 0 && avail > 0 && c.rxLen < sizeof(c.rx)) {
+    size_t room = sizeof(c.rx) - c.rxLen;
+    int got = c.client.read(c.rx + c.rxLen,
+                            (size_t)avail < room ? (size_t)avail : room);
+    if (got > 0) {
+      c.rxLen += got;
+      c.lastRx = millis();
+    }
+  }
+
+  // MBAP: transaction(2) protocol(2) length(2), then length bytes of
+  // unit + PDU.
+  while (c.rxLen >= 7) {
+    uint16_t len = ((uint16_t)c.rx[4] << 8) | c.rx[5];
+    if (c.rx[2] != 0 || c.rx[3] != 0 || len < 2 || len > 254) {
+      logLine("Modbus TCP: bad MBAP header, closing", true);
+      closeConnection(c);
+      return;
+    }
+    size_t frame = 6 + len;
+    if (frame > sizeof(c.rx)) {
+      // Longer than any request served here: answer and drop the rest.
+      if (c.rxLen >= 8)
+        writeException(c.client, c.rx, c.rx[6], c.rx[7], 0x03);
+      c.skip = frame - c.rxLen;
+      c.rxLen = 0;
+      return;
+    }
+    if (c.rxLen < frame)
+      return; // tail still in flight
+    if (!modbusTcpHandleRequest(c, c.rx, frame))
+      return; // offered again next pass
+    c.rxLen -= frame;
+    memmove(c.rx, c.rx + frame, c.rxLen);
+    c.client.flush();
+    if (gw.state != GW_IDLE && gw.conn == &c)
+      return;
   }
 }
 
-static void modbusTcpHandleRequest(EthernetClient &client,
-                                   const uint8_t *request, size_t n) {
-  if (n < 12)
+static void closeConnection(MbConnection &c) {
+  c.client.stop();
+  c.rxLen = 0;
+  c.skip = 0;
+  if (gw.conn != &c)
     return;
+  gw.conn = nullptr;
+  if (gw.state == GW_WAITING)
+    gw.state = GW_IDLE;
+}
+
+// Returns false if the request has to wait (gateway busy, no frame
+// buffer) and must be offered again on a later pass.
+static bool modbusTcpHandleRequest(MbConnection &c, const uint8_t *request,
+                                   size_t n) {
+  if (n < 12) {
+    // Every function served here carries address + count/value.
+    writeException(c.client, request, request[6], request[7], 0x03);
+    return true;
+  }
 
-  uint16_t trans_id = (request[0] << 8) | request[1];
-  uint16_t len = (request[4] << 8) | request[5];
   uint8_t unit_id = request[6];
+  uint8_t func = request[7];
+
+  if (unit_id == UNIT_ID)
+    return relayRequest(c, request, n);
+  if (gatewayRoutes(unit_id))
+    return gatewayQueue(c, request);
 
+  switch (func) {
+  case 3:
+  case 4:
+    return serveRegisters(c, request);
+  case 6:
+  case 16:
+    return writeSettings(c, request, n);
+  default:
+    writeException(c.client, request, unit_id, func, 0x01);
+    return true;
+  }
+}
+
+// FC3: send_arr image, then the settings block and the channel map; FC4:
+// input image.
+static bool serveRegisters(MbConnection &c, const uint8_t *request) {
   uint8_t func = request[7];
   uint16_t addr = (request[8] << 8) | request[9];
   uint16_t count = (request[10] << 8) | request[11];
+  if (count == 0 || count > 125) {
+    writeException(c.client, request, request[6], func, 0x03);
+    return true;
+  }
 
-  uint16_t total_regs = SEND_ARR_SIZE * 2; // 2 regs per float32
-
-  if (func == 3 && (addr + count) <= total_regs) {
-    uint16_t byte_count = count * 2;
-    uint16_t pdu_len = 1 + 1 + byte_count; // func + byte_count + data
-
-    uint8_t resp[260];
-    // MBAP
-    resp[0] = (trans_id >> 8) & 0xFF;
-    resp[1] = (trans_id) & 0xFF;
-    resp[2] = 0;
-    resp[3] = 0; // protocol=0
-    resp[4] = (pdu_len + 1) >> 8;
-    resp[5] = (pdu_len + 1) & 0xFF; // unit + PDU
-    resp[6] = unit_id;
-
-    // PDU
-    resp[7] = func;
-    resp[8] = byte_count;
-
-    for (uint16_t i = 0; i < count; i++) {
-      uint16_t reg_index = addr + i;
-      uint16_t fidx = reg_index / 2; // value index
-      uint8_t part = reg_index % 2;  // 0=AB, 1=CD
-
-      float f = (float)send_arr[fidx];
-      uint32_t fbits;
-      memcpy(&fbits, &f, sizeof(float));
-
-      if (part == 0) {                           // high word
-        resp[9 + i * 2] = (fbits) & 0xFF;        // C
-        resp[10 + i * 2] = (fbits >> 8) & 0xFF;  // D
-      } else {                                   // low word
-        resp[9 + i * 2] = (fbits >> 16) & 0xFF;  // A
-        resp[10 + i * 2] = (fbits >> 24) & 0xFF; // B
-      }
-    }
+  FrameLease frame;
+  if (!frame.ok())
+    return false;
+  uint8_t *pdu = frame.data() + 7; // after MBAP + unit
+  uint16_t byte_count = count * 2;
+  pdu[0] = func;
+  pdu[1] = byte_count;
 
-    client.write(resp, 9 + byte_count);
+  bool ok;
+  if (func == 3 && addr >= HR_CHANNEL_MAP_ADDR) {
+    uint16_t first = addr - HR_CHANNEL_MAP_ADDR;
+    ok = first <= MAX_DEVICE_ID && count <= MAX_DEVICE_ID + 1 - first;
+    for (uint16_t i = 0; ok && i < count; ++i) {
+      pdu[2 + i * 2] = channelMapWordOf(first + i) >> 8;
+      pdu[3 + i * 2] = channelMapWordOf(first + i);
+    }
+  } else if (func == 3 && addr >= HR_SETTINGS_ADDR) {
+    uint16_t first = addr - HR_SETTINGS_ADDR;
+    ok = first < SETTINGS_COUNT && count <= SETTINGS_COUNT - first;
+    for (uint16_t i = 0; ok && i < count; ++i) {
+      pdu[2 + i * 2] = station_settings[first + i] >> 8;
+      pdu[3 + i * 2] = station_settings[first + i];
+    }
   } else {
-    uint8_t err[] = {(uint8_t)(trans_id >> 8),
-                     (uint8_t)trans_id,
-                     0,
-                     0,
-                     0,
-                     3,
-                     unit_id,
-                     (uint8_t)(func | 0x80),
-                     0x02};
-    client.write(err, sizeof(err));
+    ok = registerImageRead(func == 4 ? REG_INPUT : REG_HOLDING, addr, count,
+                           pdu + 2);
+  }
+  if (!ok) {
+    writeException(c.client, request, request[6], func, 0x02);
+    return true;
   }
+  writeReply(c.client, request, request[6], frame.data(), 2 + byte_count);
+  return true;
+}
+
+// FC6/FC16 on the settings block or the channel map. Every value is
+// range-checked before any is applied; a map write is saved to EEPROM.
+static bool writeSettings(MbConnection &c, const uint8_t *request, size_t n) {
+  uint8_t func = request[7];
+  uint16_t addr = (request[8] << 8) | request[9];
+  uint16_t count = 1;
+  const uint8_t *values = request + 10;
+  if (func == 16) {
+    count = (request[10] << 8) | request[11];
+    values = request + 13;
+    if (count == 0 || n < 13 || request[12] != count * 2 ||
+        n < 13u + count * 2) {
+      writeException(c.client, request, request[6], func, 0x03);
+      return true;
+    }
+  }
+
+  bool map = addr >= HR_CHANNEL_MAP_ADDR;
+  uint16_t base = map ? HR_CHANNEL_MAP_ADDR : HR_SETTINGS_ADDR;
+  uint16_t size = map ? MAX_DEVICE_ID + 1 : SETTINGS_COUNT;
+  uint16_t first = addr - base;
+  if (addr < base || first >= size || count > size - first) {
+    writeException(c.client, request, request[6], func, 0x02);
+    return true;
+  }
+  for (uint16_t i = 0; i < count; ++i) {
+    uint16_t v = (values[i * 2] << 8) | values[i * 2 + 1];
+    bool valid =
+        map ? channelMapValid(first + i, v) : settingValid(first + i, v);
+    if (!valid) {
+      writeException(c.client, request, request[6], func, 0x03);
+      return true;
+    }
+  }
+  for (uint16_t i = 0; i < count; ++i) {
+    uint16_t v = (values[i * 2] << 8) | values[i * 2 + 1];
+    if (map) {
+      channelMapSet(first + i, v);
+      continue;
+    }
+    station_settings[first + i] = v;
+    logLine("Setting ", false);
+    logLine(first + i, false);
+    logLine(" = ", false);
+    logLine(station_settings[first + i], true);
+  }
+  if (map)
+    channelMapSave();
+
+  // FC6 echoes the request, FC16 returns address + count
+  uint8_t out[12];
+  memcpy(out + 7, request + 7, 5);
+  writeReply(c.client, request, request[6], out, 5);
+  return true;
+}
+
+// A polling period must divide the minute, or the minute average would
+// silently cover more or less than 60 s.
+static bool settingValid(uint16_t set, uint16_t v) {
+  if (v < SETTING_LIMITS[set].min || v > SETTING_LIMITS[set].max)
+    return false;
+  return set != SET_MONITOR_MS || MIN % v == 0;
+}
+
+// Unit UNIT_ID is the relay board: FC1 reads its coils, FC5/FC15 switch
+// channels 0..RELAY_CHANNELS-1 through relay.cpp, which refuses the
+// router channel while its power-cycle pulse runs (exception 0x06).
+static bool relayRequest(MbConnection &c, const uint8_t *request, size_t n) {
+  uint8_t func = request[7];
+  uint16_t addr = (request[8] << 8) | request[9];
+  uint16_t count = (request[10] << 8) | request[11];
+  uint8_t code = 0;
+
+  switch (func) {
+  case 1:
+    if (count == 0 || addr >= 8 || count > 8 - addr)
+      code = 0x02;
+    break;
+  case 5:
+    if (addr >= RELAY_CHANNELS)
+      code = 0x02;
+    else if (count != 0xFF00 && count != 0x0000)
+      code = 0x03;
+    break;
+  case 15:
+    if (count == 0 || addr >= RELAY_CHANNELS ||
+        count > RELAY_CHANNELS - addr)
+      code = 0x02;
+    else if (n < 14 || request[12] != 1)
+      code = 0x03;
+    break;
+  default:
+    code = 0x01;
+  }
+  if (code != 0) {
+    writeException(c.client, request, request[6], func, code);
+    return true;
+  }
+
+  if (!gatewayStart(c, request, RS485_PRIO_CONTROL, &RELAY_TIMEOUTS))
+    return false;
+  if (func == 1) {
+    gatewayService();
+    return true;
+  }
+  gw.coilBits = func == 15 ? request[13] : count == 0xFF00;
+  relayCoilStep();
+  return true;
+}
+
+static bool gatewayRoutes(uint8_t unit) {
+  return unit <= MAX_DEVICE_ID && (GATEWAY_UNITS & (1u << unit)) &&
+         topologyHas(unit) && !topologyIsBridged(unit);
+}
+
+// Reads only (FC1..4): the request must fit Rs485Request and the reply
+// RS485_MAX_RESP.
+static bool gatewayQueue(MbConnection &c, const uint8_t *request) {
+  uint8_t func = request[7];
+  uint16_t count = (request[10] << 8) | request[11];
+  uint16_t maxCount =
+      (func <= 2) ? RS485_MAX_READ_REGS * 16 : RS485_MAX_READ_REGS;
+  if (func < 1 || func > 4) {
+    writeException(c.client, request, request[6], func, 0x01);
+    return true;
+  }
+  if (count == 0 || count > maxCount) {
+    writeException(c.client, request, request[6], func, 0x03);
+    return true;
+  }
+  if (!gatewayStart(c, request, RS485_PRIO_BACKGROUND, nullptr))
+    return false;
+  gatewayService();
+  return true;
+}
+
+// Takes the gateway slot for request, forwarding its first 6 ADU bytes
+// unchanged. False if another request holds the slot.
+static bool gatewayStart(MbConnection &c, const uint8_t *request,
+                         Rs485Priority priority,
+                         const TimeoutLimits *limits) {
+  if (gw.state != GW_IDLE)
+    return false;
+  memcpy(gw.mbap, request, sizeof(gw.mbap));
+  memcpy(gw.head, request + 6, sizeof(gw.head));
+  memcpy(gw.req.adu, gw.head, sizeof(gw.head));
+  gw.req.len = 6;
+  gw.req.priority = priority;
+  gw.req.limits = limits;
+  gw.req.done = onGatewayReply;
+  gw.req.ctx = nullptr;
+  gw.coilNext = 0;
+  gw.conn = &c;
+  gw.state = GW_WAITING;
+  return true;
+}
+
+// FC5/FC15: hands the write of coil head.addr + coilNext to relay.cpp.
+static void relayCoilStep() {
+  uint16_t coil = ((gw.head[2] << 8) | gw.head[3]) + gw.coilNext;
+  bool on = (gw.coilBits >> gw.coilNext) & 0x01;
+  if (relayWriteChannel(coil, on, onGatewayReply, nullptr)) {
+    gw.state = GW_ON_BUS;
+    return;
+  }
+  gw.state = GW_IDLE;
+  if (gw.conn != nullptr)
+    writeException(gw.conn->client, gw.mbap, gw.head[0], gw.head[1],
+                   relayChannelLocked(coil) ? 0x06 : 0x0A);
+}
+
+static void gatewayService() {
+  if (gw.state != GW_WAITING || millis() - gw_last_ms < GATEWAY_MIN_GAP_MS)
+    return;
+  gw_last_ms = millis();
+  gw.req.deadline = gw_last_ms + GATEWAY_QUEUE_MS;
+  if (rs485Submit(gw.req)) {
+    gw.state = GW_ON_BUS;
+    return;
+  }
+  gw.state = GW_IDLE;
+  if (gw.conn != nullptr)
+    writeException(gw.conn->client, gw.mbap, gw.head[0], gw.head[1], 0x0A);
+}
+
+static void onGatewayReply(void *ctx, const Rs485Result &res) {
+  (void)ctx;
+  gw.state = GW_IDLE;
+  if (gw.conn == nullptr || !gw.conn->client.connected())
+    return;
+  EthernetClient &client = gw.conn->client;
+
+  if (res.status != RS485_OK && res.status != RS485_EXCEPTION) {
+    // 0x0A: no path to the device (bus busy), 0x0B: device did not answer
+    writeException(client, gw.mbap, gw.head[0], gw.head[1],
+                   res.status == RS485_EXPIRED ? 0x0A : 0x0B);
+    return;
+  }
+
+  if (gw.head[1] == 15) {
+    uint16_t count = (gw.head[4] << 8) | gw.head[5];
+    if (res.status == RS485_EXCEPTION) {
+      writeException(client, gw.mbap, gw.head[0], 15, res.resp[2]);
+      return;
+    }
+    if (++gw.coilNext < count) {
+      relayCoilStep();
+      return;
+    }
+    uint8_t out[12];
+    memcpy(out + 7, gw.head + 1, 5); // FC, address, count
+    writeReply(client, gw.mbap, gw.head[0], out, 5);
+    return;
+  }
+
+  // RTU ADU minus unit and CRC is the PDU behind the original MBAP header
+  uint8_t out[7 + RS485_MAX_RESP];
+  memcpy(out + 7, res.resp + 1, res.len - 3);
+  writeReply(client, gw.mbap, gw.head[0], out, res.len - 3);
+}
+
+// adu holds the PDU from offset 7; the MBAP header and unit are filled in
+// and the reply goes out in one write.
+static void writeReply(EthernetClient &client, const uint8_t *mbap,
+                       uint8_t unit, uint8_t *adu, uint8_t pduLen) {
+  adu[0] = mbap[0]; // transaction ID
+  adu[1] = mbap[1];
+  adu[2] = 0; // protocol
+  adu[3] = 0;
+  adu[4] = 0;
+  adu[5] = pduLen + 1; // unit + PDU
+  adu[6] = unit;
+  client.write(adu, 7 + pduLen);
+  client.flush();
+}
+
+static void writeException(EthernetClient &client, const uint8_t *mbap,
+                           uint8_t unit, uint8_t func, uint8_t code) {
+  uint8_t err[] = {mbap[0], mbap[1], 0, 0, 0, 3,
+                   unit,    (uint8_t)(func | 0x80), code};
+  client.write(err, sizeof(err));
 }
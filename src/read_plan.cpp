@@ -0,0 +1,51 @@
+#include "read_plan.h"
+
+uint8_t planRegisterReads(const RegSpan *spans, uint8_t n, uint16_t maxGap,
+                          uint16_t maxRegs, RegRead *out, uint8_t outMax) {
+  uint8_t planned = 0;
+  for (uint8_t i = 0; i < n; ++i) {
+    const RegSpan &s = spans[i];
+    uint16_t sEnd = s.addr + s.qty;
+    if (planned > 0) {
+      RegRead &cur = out[planned - 1];
+      uint16_t curEnd = cur.addr + cur.qty;
+      uint16_t gap = (s.addr > curEnd) ? (s.addr - curEnd) : 0;
+      uint16_t newEnd = (sEnd > curEnd) ? sEnd : curEnd;
+      if (s.addr >= cur.addr && gap <= maxGap &&
+          newEnd - cur.addr <= maxRegs) {
+        cur.qty = newEnd - cur.addr;
+        cur.count++;
+        continue;
+      }
+    }
+    if (planned >= outMax)
+      return 0;
+    out[planned].addr = s.addr;
+    out[planned].qty = s.qty;
+    out[planned].first = i;
+    out[planned].count = 1;
+    planned++;
+  }
+  return planned;
+}
+
+void sliceRegisterRead(const RegRead &rd, const RegSpan *spans,
+                       const uint16_t *regs, uint16_t *out) {
+  uint16_t pos = 0;
+  for (uint8_t i = 0; i < rd.first; ++i)
+    pos += spans[i].qty;
+
+  for (uint8_t i = rd.first; i < rd.first + rd.count; ++i) {
+    const uint16_t *src = regs + (spans[i].addr - rd.addr);
+    memcpy(out + pos, src, spans[i].qty * sizeof(uint16_t));
+    pos += spans[i].qty;
+  }
+}
+
+uint16_t maxReadRegsFor(uint8_t id) {
+  for (uint8_t i = 0; i < READ_LIMITS_CNT; ++i) {
+    if (READ_LIMITS[i].id == id)
+      return READ_LIMITS[i].maxRegs;
+  }
+  return MB_MAX_READ_REGS;
+}
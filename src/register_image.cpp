@@ -0,0 +1,125 @@
+#include "register_image.h"
+#include "bus_topology.h"
+#include "device_health.h"
+#include "frame_pool.h"
+#include "minute_log.h"
+#include "rollup.h"
+#include "sram_watch.h"
+#include "utils.h"
+
+static uint8_t holding[2][IMAGE_HOLDING_REGS * 2];
+static uint8_t input[2][IMAGE_INPUT_REGS * 2];
+static volatile uint8_t holding_front = 0; // copies readers use
+static volatile uint8_t input_front = 0;
+
+static void encodeStatus(uint8_t *img);
+static void encodeFloat(uint8_t *p, float f);
+static void encodeU16(uint8_t *p, uint16_t v);
+static void encodeU32(uint8_t *p, uint32_t v);
+
+void registerImagePublish() {
+  uint8_t back = holding_front ^ 1;
+  for (uint16_t i = 0; i < SEND_ARR_SIZE; ++i)
+    encodeFloat(holding[back] + i * 4, (float)send_arr[i]);
+  encodeStatus(holding[back]);
+  holding_front = back;
+}
+
+void registerImagePublishInput() {
+  // send_arr is unchanged: copy it over and refresh the status only
+  uint8_t hback = holding_front ^ 1;
+  memcpy(holding[hback], holding[holding_front], sizeof(holding[0]));
+  encodeStatus(holding[hback]);
+  holding_front = hback;
+
+  uint8_t back = input_front ^ 1;
+  uint8_t *img = input[back];
+
+  for (uint8_t ch = 0; ch < CH_COUNT; ++ch)
+    encodeFloat(img + (IR_LIVE_ADDR + ch * 2) * 2,
+                channelLiveValue((ChannelIndex)ch));
+
+  uint16_t present = 0, open = 0;
+  for (uint8_t id = 1; id <= MAX_DEVICE_ID; ++id) {
+    if (!topologyHas(id))
+      continue;
+    present |= 1u << id;
+    if (deviceStats(id).state == DEV_OPEN)
+      open |= 1u << id;
+  }
+  uint8_t *d = img + IR_DIAG_ADDR * 2;
+  encodeU32(d + 0, millis() / SEC);
+  encodeU16(d + 4, cycle_stale_channels);
+  encodeU16(d + 6, present);
+  encodeU16(d + 8, open);
+  encodeU16(d + 10, framePoolStats().refused);
+  encodeU16(d + 12, sramLowWater());
+  encodeU16(d + 14, minuteLogOverwritten());
+
+  uint32_t now = millis();
+  for (uint8_t ch = 0; ch < CH_COUNT; ++ch) {
+    uint32_t at = channelSampleMs((ChannelIndex)ch);
+    uint32_t age = at ? (now - at) / 100 : 0xFFFF;
+    encodeU16(img + (IR_AGE_ADDR + ch) * 2, age > 0xFFFF ? 0xFFFF : age);
+  }
+
+  input_front = back;
+}
+
+bool registerImageRead(RegisterTable table, uint16_t addr, uint16_t count,
+                       uint8_t *out) {
+  if (table == REG_INPUT && addr >= IR_ROLLUP_ADDR)
+    return rollupReadRegs(addr - IR_ROLLUP_ADDR, count, out);
+  const uint8_t *img = (table == REG_INPUT) ? input[input_front]
+                                            : holding[holding_front];
+  uint16_t regs = (table == REG_INPUT) ? IMAGE_INPUT_REGS : IMAGE_HOLDING_REGS;
+  if (count == 0 || addr >= regs || count > regs - addr)
+    return false;
+  memcpy(out, img + addr * 2, count * 2);
+  return true;
+}
+
+static void encodeStatus(uint8_t *img) {
+  const AggregateInfo &agg = aggregateInfo();
+  uint32_t age = (millis() - agg.computedMs) / SEC;
+  if (agg.seq == 0)
+    age = millis() / SEC; // nothing aggregated yet: age of the defaults
+  encodeU32(img + HR_STATUS_SEQ * 2, agg.seq);
+  encodeU16(img + HR_STATUS_AGE * 2, age > 0xFFFF ? 0xFFFF : age);
+  encodeU32(img + HR_STATUS_UPTIME * 2, millis() / SEC);
+
+  for (uint8_t ch = 0; ch < CH_COUNT; ++ch) {
+    uint8_t n = agg.samples[ch];
+    uint8_t q = 0;
+    if (ch == CH_R)
+      ; // send_arr carries the live reading, not a minute average
+    else if (n == 0)
+      q |= QUALITY_NO_DATA;
+    else if (n < samplesPerMinute())
+      q |= QUALITY_PARTIAL;
+    if (cycle_stale_channels & chBit((ChannelIndex)ch))
+      q |= QUALITY_STALE;
+    encodeU16(img + (HR_STATUS_CHANNELS + ch) * 2, ((uint16_t)q << 8) | n);
+  }
+}
+
+// Register layout the SCADA expects for each float32: C D | A B.
+static void encodeFloat(uint8_t *p, float f) {
+  uint32_t fbits;
+  memcpy(&fbits, &f, sizeof(float));
+  p[0] = fbits & 0xFF;         // C
+  p[1] = (fbits >> 8) & 0xFF;  // D
+  p[2] = (fbits >> 16) & 0xFF; // A
+  p[3] = (fbits >> 24) & 0xFF; // B
+}
+
+static void encodeU16(uint8_t *p, uint16_t v) {
+  p[0] = v >> 8;
+  p[1] = v;
+}
+
+// High word first.
+static void encodeU32(uint8_t *p, uint32_t v) {
+  encodeU16(p, v >> 16);
+  encodeU16(p + 2, v);
+}
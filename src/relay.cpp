@@ -1,89 +1,58 @@
 #include "relay.h"
+#include "bus_topology.h"
 #include "config.h"
+#include "frame_pool.h"
+#include "rollup.h"
+#include "rs485_bus.h"
 #include "utils.h"
 #include "serial.h"
 #include <stdio.h>
 #include <string.h>
 
-uint8_t relay_on[] = {0x0B, 0x05, 0x00, 0x00, 0xFF, 0x00, 0x00, 0x00};
-uint8_t relay_off[] = {0x0B, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-
 bool relay_turn_off = false;
 bool relay_turn_on = false;
 static EthernetServer relay_http_server(RELAY_HTTP_PORT);
 static EthernetClient relay_http_client;
 
-static bool relayWriteChannel(uint8_t unitId, uint8_t channel, bool on);
-static bool relayReadStatusByte(uint8_t unitId, uint8_t &status);
+// Relay command of the HTTP client in flight; the client is answered from
+// the RS-485 callback and no other request is accepted meanwhile.
+struct HttpRelayOp {
+  bool pending;
+  uint8_t relayId; // 1..4, 0 = status read
+  bool on;
+};
+static HttpRelayOp http_op = {false, 0, false};
+
+static bool relaySubmitHttpWrite(uint8_t relayId, bool on);
+static bool relaySubmitHttpStatus(uint8_t unitId);
+static void prepareStatusRead(Rs485Request &req, uint8_t unitId);
+static bool isCoilEcho(const Rs485Result &res, uint8_t channel, bool on);
+static bool relaySubmitCoil(uint8_t unitId, uint8_t channel, bool on);
+static void onRelayPulseDone(void *ctx, const Rs485Result &res);
+static void onRelayStatusLogged(void *ctx, const Rs485Result &res);
+static void onHttpRelayDone(void *ctx, const Rs485Result &res);
 static bool readHttpRequestLine(EthernetClient &client, char *line, size_t maxLen,
                                 uint16_t timeoutMs = 700);
 static void drainHttpHeaders(EthernetClient &client, uint16_t timeoutMs = 200);
+static void sendJsonHead(EthernetClient &client, int statusCode,
+                         const char *statusText, size_t length);
 static void sendJson(EthernetClient &client, int statusCode,
                      const char *statusText, const char *body);
 static void handleRelayHttpPath(EthernetClient &client, const char *path);
-
-static uint16_t crc16_modbus(const uint8_t *p, size_t n) {
-  logLine("crc16_modbus", true);
-  uint16_t crc = 0xFFFF;
-  while (n--) {
-    crc ^= *p++;
-    for (uint8_t i = 0; i < 8; i++) {
-      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : (crc >> 1);
-    }
-  }
-  return crc;
-}
-
-bool sendModbus(uint8_t *req, int reqLen, uint8_t *resp, int respLen, int timeout = 500) {
-
-  while (Serial3.available()) Serial3.read();
-
-  Serial3.write(req, reqLen);
-  Serial3.flush();
-  post_transmission_main();
-
-  unsigned long start = millis();
-  int index = 0;
-
-  while (millis() - start < timeout) {
-    if (Serial3.available()) {
-      uint8_t b = Serial3.read();
-      if (resp != nullptr && respLen > 0) {
-        resp[index++] = b;
-        if (index >= respLen) return true;
-      } else {
-        (void)b;
-      }
-    }
-  }
-  return false;
-}
+static void sendLiveSamples(EthernetClient &client);
+static void sendRollup(EthernetClient &client, uint8_t minutes, uint8_t k);
+static size_t printRollup(EthernetClient *client, uint8_t minutes, uint8_t k,
+                          const RollupRecord &rec);
 
 static void relayTimedPulse(uint8_t unitId, uint8_t channel) {
   static uint32_t start_time = 0;
-  uint16_t crc;
-  relay_on[0] = (uint8_t)(unitId & 0xFF);
-  relay_on[3] = (uint8_t)(channel & 0xFF);
-  relay_off[0] = (uint8_t)(unitId & 0xFF);
-  relay_off[3] = (uint8_t)(channel & 0xFF);
-  uint8_t len_relay_on = sizeof(relay_on);
-  uint8_t len_relay_off = sizeof(relay_off);
 
+  // A flag is cleared only once its write is queued; a full queue retries
+  // on the next pass.
   if (relay_turn_off) {
     logLine("Relay Stop id 0", true);
-    if (!rs485_acquire(300)) {
-      logLine("RS485 busy, skip relay pulse", true);
+    if (!relaySubmitCoil(unitId, channel, true))
       return;
-    }
-
-    pre_transmission_main();
-    crc = crc16_modbus(relay_on, len_relay_on - 2);
-    relay_on[len_relay_on - 2] = crc & 0xFF;
-    relay_on[len_relay_on - 1] = crc >> 8;
-
-    sendModbus(relay_on, len_relay_on, nullptr, 0);
-
-    rs485_release();
     start_time = millis();
     relay_turn_off = false;
   }
@@ -100,40 +69,80 @@ static void relayTimedPulse(uint8_t unitId, uint8_t channel) {
 
   if (millis() - start_time >= RELAY_PULSE_MS && relay_turn_on) {
     logLine("Relay Start id 0", true);
-
-    if (!rs485_acquire(300)) {
-      logLine("RS485 busy, skip relay pulse", true);
+    if (!relaySubmitCoil(unitId, channel, false))
       return;
-    }
+    start_time = millis();
+    relay_turn_on = false;
+  }
+}
+
+// Queues a coil write ahead of routine polling; the result is only logged.
+static bool relaySubmitCoil(uint8_t unitId, uint8_t channel, bool on) {
+  Rs485Request req;
+  rs485PrepareWriteCoil(req, unitId, channel, on, RS485_PRIO_CONTROL);
+  req.limits = &RELAY_TIMEOUTS;
+  req.done = onRelayPulseDone;
+  if (rs485Submit(req))
+    return true;
+  logLine("RS485 queue full, relay pulse retried", true);
+  return false;
+}
 
-    pre_transmission_main();
-    crc = crc16_modbus(relay_off, len_relay_off - 2);
-    relay_off[len_relay_off - 2] = crc & 0xFF;
-    relay_off[len_relay_off - 1] = crc >> 8;
+bool relayChannelLocked(uint8_t channel) {
+  return channel == CH && (relay_turn_off || relay_turn_on);
+}
 
-    sendModbus(relay_off, len_relay_off, nullptr, 0);
+bool relayWriteChannel(uint8_t channel, bool on, Rs485Callback done,
+                       void *ctx) {
+  if (channel >= RELAY_CHANNELS || relayChannelLocked(channel))
+    return false;
+  Rs485Request req;
+  rs485PrepareWriteCoil(req, UNIT_ID, channel, on, RS485_PRIO_CONTROL);
+  req.limits = &RELAY_TIMEOUTS;
+  req.done = done;
+  req.ctx = ctx;
+  if (!rs485Submit(req)) {
+    logLine("RS485 queue full, skip relay write", true);
+    return false;
+  }
+  logLine("Relay CH", false);
+  logLine(channel, false);
+  logLine(on ? " on" : " off", true);
+  return true;
+}
 
-    rs485_release();
-    start_time = millis();
-    relay_turn_on = false;
+static void onRelayPulseDone(void *ctx, const Rs485Result &res) {
+  (void)ctx;
+  if (res.status != RS485_OK) {
+    logLine("Relay pulse write failed: ", false);
+    logLine(res.status, true);
   }
 }
 
 static void getrelayStatus() {
-  uint8_t status = 0;
-  if (relayReadStatusByte(UNIT_ID, status)) {
-    logLine("Relay status byte: 0x", false);
-    logLine(status, HEX, true);
-
-    for (uint8_t i = 0; i < 8; ++i) {
-      logLine("CH", false);
-      logLine(i, false);
-      logLine(": ", false);
-      logLine(bitRead(status, i), true);
-    }
+  Rs485Request req;
+  prepareStatusRead(req, UNIT_ID);
+  req.done = onRelayStatusLogged;
+  if (!rs485Submit(req))
+    logLine("RS485 queue full, skip relay status read", true);
+}
+
+static void onRelayStatusLogged(void *ctx, const Rs485Result &res) {
+  (void)ctx;
+  if (res.status != RS485_OK || res.len != 6 || res.resp[2] != 0x01) {
+    logLine("Failed to get relay status", true);
     return;
   }
-  logLine("Failed to get relay status", true);
+  uint8_t status = res.resp[3];
+  logLine("Relay status byte: 0x", false);
+  logLine(status, HEX, true);
+
+  for (uint8_t i = 0; i < 8; ++i) {
+    logLine("CH", false);
+    logLine(i, false);
+    logLine(": ", false);
+    logLine(bitRead(status, i), true);
+  }
 }
 
 static bool isInternetAlive(const IPAddress &testIp, uint16_t port,
@@ -175,6 +184,9 @@ void initRelayHttp() {
 }
 
 void relayHttpServiceOnce() {
+  if (http_op.pending)
+    return; // answered by onHttpRelayDone()
+
   if (relay_http_client && !relay_http_client.connected()) {
     relay_http_client.stop();
   }
@@ -217,93 +229,81 @@ void relayHttpServiceOnce() {
   *pathEnd = '\0';
 
   handleRelayHttpPath(relay_http_client, pathStart);
-  relay_http_client.stop();
+  if (!http_op.pending)
+    relay_http_client.stop();
 }
 
-static bool relayWriteChannel(uint8_t unitId, uint8_t channel, bool on) {
-  if (channel > 7) {
-    return false;
-  }
-
-  if (!rs485_acquire(300)) {
-    logLine("RS485 busy, skip relay write", true);
-    return false;
-  }
-
-  uint8_t request[8];
-  request[0] = unitId;
-  request[1] = 0x05;
-  request[2] = 0x00;
-  request[3] = channel;
-  request[4] = on ? 0xFF : 0x00;
-  request[5] = 0x00;
-
-  uint16_t crc = crc16_modbus(request, 6);
-  request[6] = crc & 0xFF;
-  request[7] = crc >> 8;
-
-  uint8_t response[8];
-  pre_transmission_main();
-  bool ok = sendModbus(request, sizeof(request), response, sizeof(response));
-
-  if (!ok) {
-    rs485_release();
-    logLine("Relay write failed: no response", true);
+static bool relaySubmitHttpWrite(uint8_t relayId, bool on) {
+  if (!relayWriteChannel(relayId - 1, on, onHttpRelayDone, &http_op))
     return false;
-  }
-
-  uint16_t respCrc = (uint16_t)response[6] | ((uint16_t)response[7] << 8);
-  uint16_t calcCrc = crc16_modbus(response, 6);
-  bool valid = (respCrc == calcCrc) && (memcmp(response, request, 6) == 0);
-
-  rs485_release();
-
-  if (!valid) {
-    logLine("Relay write failed: invalid echo", true);
-    return false;
-  }
-
+  http_op.pending = true;
+  http_op.relayId = relayId;
+  http_op.on = on;
   return true;
 }
 
-static bool relayReadStatusByte(uint8_t unitId, uint8_t &status) {
-  if (!rs485_acquire(300)) {
-    logLine("RS485 busy, skip relay status read", true);
+static bool relaySubmitHttpStatus(uint8_t unitId) {
+  Rs485Request req;
+  prepareStatusRead(req, unitId);
+  req.done = onHttpRelayDone;
+  req.ctx = &http_op;
+  if (!rs485Submit(req)) {
+    logLine("RS485 queue full, skip relay status read", true);
     return false;
   }
+  http_op.pending = true;
+  http_op.relayId = 0;
+  return true;
+}
 
-  uint8_t request[8];
-  request[0] = unitId;
-  request[1] = 0x01;
-  request[2] = 0x00;
-  request[3] = 0x00;
-  request[4] = 0x00;
-  request[5] = 0x08;
-
-  uint16_t crc = crc16_modbus(request, 6);
-  request[6] = crc & 0xFF;
-  request[7] = crc >> 8;
+static void prepareStatusRead(Rs485Request &req, uint8_t unitId) {
+  rs485PrepareRead(req, unitId, 0x0000, 8, RS485_PRIO_CONTROL);
+  req.adu[1] = 0x01; // read coils
+  req.limits = &RELAY_TIMEOUTS;
+}
 
-  uint8_t response[6];
-  pre_transmission_main();
-  bool ok = sendModbus(request, sizeof(request), response, sizeof(response));
+static void onHttpRelayDone(void *ctx, const Rs485Result &res) {
+  HttpRelayOp &op = *static_cast<HttpRelayOp *>(ctx);
+  op.pending = false;
+  EthernetClient &client = relay_http_client;
+  char body[96];
 
-  if (!ok) {
-    rs485_release();
-    return false;
+  if (op.relayId == 0) {
+    if (res.status != RS485_OK || res.len != 6 || res.resp[2] != 0x01) {
+      sendJson(client, 503, "Service Unavailable",
+               "{\"ok\":false,\"error\":\"relay status read failed\"}");
+    } else {
+      uint8_t status = res.resp[3];
+      snprintf(body, sizeof(body),
+               "{\"ok\":true,\"unit_id\":%u,\"status\":[%u,%u,%u,%u]}",
+               UNIT_ID, (status >> 0) & 0x01, (status >> 1) & 0x01,
+               (status >> 2) & 0x01, (status >> 3) & 0x01);
+      sendJson(client, 200, "OK", body);
+    }
+    client.stop();
+    return;
   }
 
-  uint16_t respCrc = (uint16_t)response[4] | ((uint16_t)response[5] << 8);
-  uint16_t calcCrc = crc16_modbus(response, 4);
-  bool valid = (response[0] == unitId) && (response[1] == 0x01) &&
-               (response[2] == 0x01) && (respCrc == calcCrc);
-
-  if (valid) {
-    status = response[3];
+  if (!isCoilEcho(res, op.relayId - 1, op.on)) {
+    logLine(res.status == RS485_TIMEOUT ? "Relay write failed: no response"
+                                        : "Relay write failed: invalid echo",
+            true);
+    sendJson(client, 503, "Service Unavailable",
+             "{\"ok\":false,\"error\":\"relay write failed\"}");
+  } else {
+    snprintf(body, sizeof(body),
+             "{\"ok\":true,\"unit_id\":%u,\"relay\":%u,\"state\":\"%s\"}",
+             UNIT_ID, op.relayId, op.on ? "on" : "off");
+    sendJson(client, 200, "OK", body);
   }
+  client.stop();
+}
 
-  rs485_release();
-  return valid;
+// FC5 reply echoes the request
+static bool isCoilEcho(const Rs485Result &res, uint8_t channel, bool on) {
+  return res.status == RS485_OK && res.len == 8 && res.resp[0] == UNIT_ID &&
+         res.resp[1] == 0x05 && res.resp[2] == 0 && res.resp[3] == channel &&
+         res.resp[4] == (on ? 0xFF : 0x00) && res.resp[5] == 0;
 }
 
 static bool readHttpRequestLine(EthernetClient &client, char *line, size_t maxLen,
@@ -349,6 +349,12 @@ static void drainHttpHeaders(EthernetClient &client, uint16_t timeoutMs) {
 
 static void sendJson(EthernetClient &client, int statusCode,
                      const char *statusText, const char *body) {
+  sendJsonHead(client, statusCode, statusText, strlen(body));
+  client.print(body);
+}
+
+static void sendJsonHead(EthernetClient &client, int statusCode,
+                         const char *statusText, size_t length) {
   client.print("HTTP/1.1 ");
   client.print(statusCode);
   client.print(' ');
@@ -358,26 +364,137 @@ static void sendJson(EthernetClient &client, int statusCode,
   client.print("Connection: close\r\n");
   client.print("Access-Control-Allow-Origin: *\r\n");
   client.print("Content-Length: ");
-  client.print(strlen(body));
+  client.print(length);
   client.print("\r\n\r\n");
-  client.print(body);
+}
+
+// Latest per-second samples, one entry per channel with the value and
+// how long ago it arrived; age_ms is null for a channel never sampled.
+static void sendLiveSamples(EthernetClient &client) {
+  FrameLease frame(2);
+  if (!frame.ok()) {
+    sendJson(client, 503, "Service Unavailable",
+             "{\"ok\":false,\"error\":\"out of buffers\"}");
+    return;
+  }
+  char *body = frame.chars();
+  size_t cap = frame.size();
+  uint32_t now = millis();
+  size_t len = snprintf(body, cap, "{\"ok\":true,\"uptime_ms\":%lu,\"live\":{",
+                        (unsigned long)now);
+  bool first = true;
+  for (size_t i = 0; i < labels_len && len < cap; ++i) {
+    if (labels[i].useStd)
+      continue;
+    ChannelIndex ch = labels[i].channel;
+    char value[16];
+    dtostrf(channelLiveValue(ch), 1, 3, value);
+    uint32_t at = channelSampleMs(ch);
+    char age[12] = "null";
+    if (at)
+      snprintf(age, sizeof(age), "%lu", (unsigned long)(now - at));
+    len += snprintf(body + len, cap - len, "%s\"%s\":{\"v\":%s,\"age_ms\":%s}",
+                    first ? "" : ",", labels[i].name, value, age);
+    first = false;
+  }
+  if (len + 3 > cap) {
+    sendJson(client, 500, "Internal Server Error",
+             "{\"ok\":false,\"error\":\"response too long\"}");
+    return;
+  }
+  strcpy(body + len, "}}");
+  sendJson(client, 200, "OK", body);
+}
+
+// One rollup record in channel units, [mean, std, min, max, samples] per
+// channel (null without samples). Too long for a frame slot, so it is
+// printed twice: once to count Content-Length, once to the client.
+static void sendRollup(EthernetClient &client, uint8_t minutes, uint8_t k) {
+  RollupLevel level = minutes == 1    ? ROLLUP_MINUTE
+                      : minutes == 15 ? ROLLUP_QUARTER
+                      : minutes == 60 ? ROLLUP_HOUR
+                                      : ROLLUP_LEVELS;
+  if (level == ROLLUP_LEVELS) {
+    sendJson(client, 400, "Bad Request",
+             "{\"ok\":false,\"error\":\"period must be 1, 15 or 60\"}");
+    return;
+  }
+  const RollupRecord *rec = rollupRecord(level, k);
+  if (rec == nullptr || rec->seq == 0) {
+    sendJson(client, 404, "Not Found",
+             "{\"ok\":false,\"error\":\"no such record\"}");
+    return;
+  }
+  sendJsonHead(client, 200, "OK", printRollup(nullptr, minutes, k, *rec));
+  printRollup(&client, minutes, k, *rec);
+}
+
+static size_t printRollup(EthernetClient *client, uint8_t minutes, uint8_t k,
+                          const RollupRecord &rec) {
+  char part[96];
+  size_t total = snprintf(part, sizeof(part),
+                          "{\"ok\":true,\"period_min\":%u,\"k\":%u,"
+                          "\"seq\":%lu,\"channels\":{",
+                          minutes, k, (unsigned long)rec.seq);
+  if (client)
+    client->print(part);
+  bool first = true;
+  for (size_t i = 0; i < labels_len; ++i) {
+    if (labels[i].useStd)
+      continue;
+    ChannelIndex ch = labels[i].channel;
+    const RollupCell *c = rollupCell(rec, ch);
+    uint8_t decimals = channelScale(ch) >= 10000 ? 4
+                       : channelScale(ch) >= 1000 ? 3
+                                                  : 2;
+    float spread = channelStep(ch) * rollupSpreadDiv(ch);
+    if (c == nullptr || c->count == 0) {
+      snprintf(part, sizeof(part), "%s\"%s\":null", first ? "" : ",",
+               labels[i].name);
+    } else {
+      char mean[16], sd[16], lo[16], hi[16];
+      float m = fxToFloat(ch, c->mean);
+      dtostrf(m, 1, decimals, mean);
+      dtostrf(c->std * spread, 1, decimals, sd);
+      dtostrf(m - c->belowMean * spread, 1, decimals, lo);
+      dtostrf(m + c->aboveMean * spread, 1, decimals, hi);
+      snprintf(part, sizeof(part), "%s\"%s\":[%s,%s,%s,%s,%u]",
+               first ? "" : ",", labels[i].name, mean, sd, lo, hi, c->count);
+    }
+    first = false;
+    total += strlen(part);
+    if (client)
+      client->print(part);
+  }
+  total += 2;
+  if (client)
+    client->print("}}");
+  return total;
 }
 
 static void handleRelayHttpPath(EthernetClient &client, const char *path) {
+  if (strcmp(path, "/live") == 0) {
+    sendLiveSamples(client);
+    return;
+  }
+
+  uint8_t minutes = 0, k = 0;
+  if (sscanf(path, "/rollup/%hhu/%hhu", &minutes, &k) == 2) {
+    sendRollup(client, minutes, k);
+    return;
+  }
+
   if (strcmp(path, "/relay/status") == 0) {
-    uint8_t status = 0;
-    if (!relayReadStatusByte(UNIT_ID, status)) {
+    if (!relaySubmitHttpStatus(UNIT_ID))
       sendJson(client, 503, "Service Unavailable",
                "{\"ok\":false,\"error\":\"relay status read failed\"}");
-      return;
-    }
+    return;
+  }
 
-    char body[96];
-    snprintf(body, sizeof(body),
-             "{\"ok\":true,\"unit_id\":%u,\"status\":[%u,%u,%u,%u]}",
-             UNIT_ID, (status >> 0) & 0x01, (status >> 1) & 0x01,
-             (status >> 2) & 0x01, (status >> 3) & 0x01);
-    sendJson(client, 200, "OK", body);
+  if (strcmp(path, "/bus/discover") == 0) {
+    topologyRequestDiscovery();
+    sendJson(client, 202, "Accepted",
+             "{\"ok\":true,\"discovery\":\"scheduled\"}");
     return;
   }
 
@@ -399,22 +516,18 @@ static void handleRelayHttpPath(EthernetClient &client, const char *path) {
       return;
     }
 
-    uint8_t relayChannel = relayId - 1; // external 1..4 -> internal 0..3
-    if (!relayWriteChannel(UNIT_ID, relayChannel, turnOn)) {
+    // External 1..4 -> coil 0..3; the reply is sent from onHttpRelayDone()
+    if (relayChannelLocked(relayId - 1))
+      sendJson(client, 409, "Conflict",
+               "{\"ok\":false,\"error\":\"router power cycle running\"}");
+    else if (!relaySubmitHttpWrite(relayId, turnOn))
       sendJson(client, 503, "Service Unavailable",
                "{\"ok\":false,\"error\":\"relay write failed\"}");
-      return;
-    }
-
-    char body[96];
-    snprintf(body, sizeof(body),
-             "{\"ok\":true,\"unit_id\":%u,\"relay\":%u,\"state\":\"%s\"}",
-             UNIT_ID, relayId, turnOn ? "on" : "off");
-    sendJson(client, 200, "OK", body);
     return;
   }
 
   sendJson(client, 404, "Not Found",
            "{\"ok\":false,\"error\":\"use /relay/{1..4}/on, "
-           "/relay/{1..4}/off, /relay/status\"}");
+           "/relay/{1..4}/off, /relay/status, /bus/discover, /live, "
+           "/rollup/{1,15,60}/{k}\"}");
 }
@@ -0,0 +1,207 @@
+#include "rollup.h"
+#include "utils.h"
+#include "serial.h"
+
+// Unpacked aggregate being merged: sum is exact and m2 is the sum of
+// squared deviations from the mean, so two aggregates combine without
+// drift (Chan et al.).
+struct OpenCell {
+  uint16_t n;
+  int64_t sum;
+  uint64_t m2;
+  int32_t min;
+  int32_t max;
+};
+
+struct Ring {
+  RollupRecord *recs;
+  uint8_t slots;
+  uint8_t head; // next slot to write
+};
+
+static void mergeInto(OpenCell &a, const OpenCell &b);
+static void packCell(RollupCell &c, ChannelIndex ch, const OpenCell &o);
+static void unpackCell(OpenCell &o, ChannelIndex ch, const RollupCell &c);
+static uint16_t packSpread(ChannelIndex ch, uint32_t fx);
+static RollupRecord &pushRecord(RollupLevel level, uint32_t seq);
+static uint16_t recordRegister(const RollupRecord &r, uint16_t off);
+
+static RollupRecord minute_ring[ROLLUP_MINUTE_SLOTS];
+static RollupRecord quarter_ring[ROLLUP_QUARTER_SLOTS];
+static RollupRecord hour_ring[ROLLUP_HOUR_SLOTS];
+static Ring rings[ROLLUP_LEVELS] = {
+    {minute_ring, ROLLUP_MINUTE_SLOTS, 0},
+    {quarter_ring, ROLLUP_QUARTER_SLOTS, 0},
+    {hour_ring, ROLLUP_HOUR_SLOTS, 0},
+};
+static OpenCell open_quarter[ROLLUP_CHANNELS];
+static uint8_t quarter_minutes = 0; // minutes merged into open_quarter
+static uint8_t hour_quarters = 0;   // quarters closed in the current hour
+
+static_assert(ROLLUP_QUARTER_SLOTS >= 4, "hour merges four quarters");
+static_assert(sizeof(minute_ring) + sizeof(quarter_ring) + sizeof(hour_ring) +
+                      sizeof(open_quarter) <=
+                  ROLLUP_RAM_BUDGET,
+              "rollup rings exceed ROLLUP_RAM_BUDGET");
+
+void rollupAddMinute() {
+  uint32_t seq = aggregateInfo().seq;
+  RollupRecord &rec = pushRecord(ROLLUP_MINUTE, seq);
+  for (uint8_t i = 0; i < CH_COUNT; ++i) {
+    ChannelIndex ch = (ChannelIndex)i;
+    if (ch == CH_R)
+      continue;
+    const MinuteStats &m = minuteStats(ch);
+    uint16_t n = aggregateInfo().samples[ch];
+    OpenCell one = {n, (int64_t)m.mean * n, 0, m.min, m.max};
+    if (one.n > 1)
+      one.m2 = (uint64_t)m.std * (uint64_t)m.std * (one.n - 1);
+    packCell(rec.cells[rollupCellIndex(ch)], ch, one);
+    mergeInto(open_quarter[rollupCellIndex(ch)], one);
+  }
+
+  if (++quarter_minutes < 15)
+    return;
+  RollupRecord &quarter = pushRecord(ROLLUP_QUARTER, seq);
+  for (uint8_t i = 0; i < CH_COUNT; ++i) {
+    ChannelIndex ch = (ChannelIndex)i;
+    if (ch != CH_R)
+      packCell(quarter.cells[rollupCellIndex(ch)], ch,
+               open_quarter[rollupCellIndex(ch)]);
+  }
+  memset(open_quarter, 0, sizeof(open_quarter));
+  quarter_minutes = 0;
+
+  if (++hour_quarters < 4)
+    return;
+  // The hour comes from the packed quarters: spreads carry their rounding
+  RollupRecord &hour = pushRecord(ROLLUP_HOUR, seq);
+  for (uint8_t i = 0; i < CH_COUNT; ++i) {
+    ChannelIndex ch = (ChannelIndex)i;
+    if (ch == CH_R)
+      continue;
+    OpenCell sum = {};
+    for (uint8_t k = 0; k < 4; ++k) {
+      OpenCell part;
+      unpackCell(part, ch, *rollupCell(*rollupRecord(ROLLUP_QUARTER, k), ch));
+      mergeInto(sum, part);
+    }
+    packCell(hour.cells[rollupCellIndex(ch)], ch, sum);
+  }
+  hour_quarters = 0;
+  logLine(F("Rollup: hour closed"), true);
+}
+
+const RollupRecord *rollupRecord(RollupLevel level, uint8_t k) {
+  if (level >= ROLLUP_LEVELS || k >= rings[level].slots)
+    return nullptr;
+  const Ring &r = rings[level];
+  return &r.recs[(r.head + r.slots - 1 - k) % r.slots];
+}
+
+uint8_t rollupSlots(RollupLevel level) {
+  return level < ROLLUP_LEVELS ? rings[level].slots : 0;
+}
+
+uint16_t rollupRegisterCount() {
+  return (ROLLUP_MINUTE_SLOTS + ROLLUP_QUARTER_SLOTS + ROLLUP_HOUR_SLOTS) *
+         ROLLUP_RECORD_REGS;
+}
+
+bool rollupReadRegs(uint16_t reg, uint16_t count, uint8_t *out) {
+  if (count == 0 || reg >= rollupRegisterCount() ||
+      count > rollupRegisterCount() - reg)
+    return false;
+  for (uint16_t i = 0; i < count; ++i) {
+    uint16_t rec = (reg + i) / ROLLUP_RECORD_REGS;
+    uint16_t off = (reg + i) % ROLLUP_RECORD_REGS;
+    uint8_t level = 0;
+    while (rec >= rings[level].slots)
+      rec -= rings[level++].slots;
+    uint16_t w = recordRegister(*rollupRecord((RollupLevel)level, rec), off);
+    out[i * 2] = w >> 8;
+    out[i * 2 + 1] = w;
+  }
+  return true;
+}
+
+static uint16_t recordRegister(const RollupRecord &r, uint16_t off) {
+  if (off < 2)
+    return off == 0 ? r.seq >> 16 : r.seq;
+  const RollupCell &c = r.cells[(off - 2) / ROLLUP_CELL_REGS];
+  switch ((off - 2) % ROLLUP_CELL_REGS) {
+  case 0:
+    return (uint32_t)c.mean >> 16;
+  case 1:
+    return (uint32_t)c.mean;
+  case 2:
+    return c.std;
+  case 3:
+    return c.belowMean;
+  case 4:
+    return c.aboveMean;
+  default:
+    return c.count;
+  }
+}
+
+static RollupRecord &pushRecord(RollupLevel level, uint32_t seq) {
+  Ring &r = rings[level];
+  RollupRecord &rec = r.recs[r.head];
+  r.head = (r.head + 1) % r.slots;
+  rec.seq = seq;
+  return rec;
+}
+
+static void mergeInto(OpenCell &a, const OpenCell &b) {
+  if (b.n == 0)
+    return;
+  if (a.n == 0) {
+    a = b;
+    return;
+  }
+  uint32_t n = (uint32_t)a.n + b.n;
+  // Difference of the means in 1/256 steps, then
+  // m2 += delta^2 * na * nb / n, dividing first when that could overflow
+  int64_t delta = b.sum * 256 / b.n - a.sum * 256 / a.n;
+  uint64_t d2 = (uint64_t)(delta < 0 ? -delta : delta);
+  d2 *= d2;
+  uint64_t w = (uint64_t)a.n * b.n;
+  a.m2 += b.m2 + (d2 < ((uint64_t)1 << 40) ? (d2 * w / n) >> 16
+                                            : ((d2 >> 16) / n) * w);
+  a.sum += b.sum;
+  a.n = n;
+  if (b.min < a.min)
+    a.min = b.min;
+  if (b.max > a.max)
+    a.max = b.max;
+}
+
+static void packCell(RollupCell &c, ChannelIndex ch, const OpenCell &o) {
+  memset(&c, 0, sizeof(c));
+  if (o.n == 0)
+    return;
+  int64_t half = o.sum < 0 ? -(int64_t)(o.n / 2) : (int64_t)(o.n / 2);
+  c.mean = (int32_t)((o.sum + half) / o.n);
+  c.count = o.n;
+  if (o.n > 1)
+    c.std = packSpread(ch, isqrt64((o.m2 + (o.n - 1) / 2) / (o.n - 1)));
+  c.belowMean = packSpread(ch, (uint32_t)((int64_t)c.mean - o.min));
+  c.aboveMean = packSpread(ch, (uint32_t)((int64_t)o.max - c.mean));
+}
+
+static void unpackCell(OpenCell &o, ChannelIndex ch, const RollupCell &c) {
+  int32_t div = rollupSpreadDiv(ch);
+  uint64_t sd = (uint64_t)c.std * div;
+  o.n = c.count;
+  o.sum = (int64_t)c.mean * c.count;
+  o.m2 = c.count > 1 ? sd * sd * (c.count - 1) : 0;
+  o.min = c.mean - (int32_t)c.belowMean * div;
+  o.max = c.mean + (int32_t)c.aboveMean * div;
+}
+
+static uint16_t packSpread(ChannelIndex ch, uint32_t fx) {
+  int32_t div = rollupSpreadDiv(ch);
+  uint32_t v = (fx + div / 2) / div;
+  return v > 0xFFFF ? 0xFFFF : v;
+}
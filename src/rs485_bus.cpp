@@ -0,0 +1,358 @@
+#include "rs485_bus.h"
+#include "device_health.h"
+#include "modbus_crc.h"
+#include "serial.h"
+
+enum BusState : uint8_t {
+  BUS_IDLE,
+  BUS_SENDING,    // ADU going out from the UDRE interrupt
+  BUS_WAIT_REPLY, // reply assembled by the RX interrupt
+};
+
+struct QueueSlot {
+  Rs485Request req;
+  uint8_t seq;
+  bool used;
+};
+
+// Timer1 at F_CPU/64 measures the 3.5-character silence after every byte.
+constexpr uint16_t T35_TICKS = (uint16_t)(RS485_FRAME_GAP_US * (F_CPU / 1000000UL) / 64);
+constexpr uint8_t T35_CLOCK = (1 << WGM12) | (1 << CS11) | (1 << CS10);
+constexpr uint8_t T35_STOPPED = (1 << WGM12);
+// Wire time of the longest reply we accept, 8N1, rounded up
+constexpr uint16_t MAX_RESP_WIRE_MS =
+    (RS485_MAX_RESP * 10UL * 1000UL + SERIAL3_BAUD - 1) / SERIAL3_BAUD;
+
+static QueueSlot queue[RS485_QUEUE_LEN];
+static uint8_t next_seq = 0;
+
+static BusState state = BUS_IDLE;
+static Rs485Request current;
+static uint16_t reply_timeout_ms = 0;
+static uint32_t tx_done_ms = 0;
+static uint32_t reply_end_ms = 0;
+
+// Shared with the interrupts below
+static uint8_t rx_buf[RS485_MAX_RESP];
+static volatile uint8_t rx_len = 0;
+static volatile uint16_t rx_crc = MODBUS_CRC_INIT; // over rx_buf[0..rx_len)
+static volatile bool rx_open = false;     // bytes belong to the reply
+static volatile bool rx_error = false;    // framing/parity/overrun/overflow
+static volatile bool frame_ready = false; // T3.5 silence closed the reply
+static volatile bool line_silent = true;  // T3.5 passed since the last byte
+static volatile uint8_t tx_pos = 0;
+static volatile uint8_t tx_len = 0;
+static volatile bool tx_busy = false;
+static volatile uint32_t tx_end_ms = 0;
+static volatile uint32_t rx_end_ms = 0;
+
+// DIR pin resolved once; toggled inline instead of through digitalWrite()
+static volatile uint8_t *dir_port = nullptr;
+static uint8_t dir_mask = 0;
+
+static inline void dirTransmit(bool on) {
+  uint8_t sreg = SREG;
+  cli();
+  if (on)
+    *dir_port |= dir_mask;
+  else
+    *dir_port &= ~dir_mask;
+  SREG = sreg;
+}
+
+static inline void restartSilenceTimer() {
+  line_silent = false;
+  TCNT1 = 0;
+  TIFR1 = (1 << OCF1A);
+  TCCR1B = T35_CLOCK;
+}
+
+static QueueSlot *nextSlot();
+static void startTransaction();
+static void pollReply();
+static void finish(Rs485Status status);
+static uint8_t replyLength(const uint8_t *buf, uint8_t got);
+
+// USART3 is driven directly: Serial3 must not be referenced anywhere else,
+// otherwise the core's USART3 interrupt handlers get linked in as well.
+void rs485Init() {
+  pinMode(RS485_DIR_PIN, OUTPUT);
+  dir_port = portOutputRegister(digitalPinToPort(RS485_DIR_PIN));
+  dir_mask = digitalPinToBitMask(RS485_DIR_PIN);
+  dirTransmit(false);
+
+  UBRR3 = (uint16_t)((F_CPU / 8 / SERIAL3_BAUD - 1) / 2);
+  UCSR3A = 0;
+  UCSR3C = (1 << UCSZ31) | (1 << UCSZ30); // 8N1, as Serial3.begin()
+  UCSR3B = (1 << RXEN3) | (1 << TXEN3) | (1 << RXCIE3) | (1 << TXCIE3);
+
+  TCCR1A = 0;
+  TCCR1B = T35_STOPPED;
+  OCR1A = T35_TICKS;
+  TIMSK1 = (1 << OCIE1A);
+}
+
+bool rs485Submit(const Rs485Request &req) {
+  if (req.len + 2 > RS485_MAX_REQ)
+    return false;
+  // Reads must fit rx_buf (the quantity is in adu[4..5] for FC1..FC4)
+  if (req.adu[1] >= 0x01 && req.adu[1] <= 0x04) {
+    uint16_t qty = ((uint16_t)req.adu[4] << 8) | req.adu[5];
+    uint16_t bytes = (req.adu[1] <= 0x02) ? (qty + 7) / 8 : qty * 2;
+    if (bytes + 5 > RS485_MAX_RESP)
+      return false;
+  }
+  for (uint8_t i = 0; i < RS485_QUEUE_LEN; ++i) {
+    if (queue[i].used)
+      continue;
+    queue[i].req = req;
+    queue[i].seq = next_seq++;
+    queue[i].used = true;
+    return true;
+  }
+  return false;
+}
+
+void rs485Service() {
+  if (state == BUS_SENDING) {
+    if (tx_busy)
+      return;
+    noInterrupts();
+    tx_done_ms = tx_end_ms;
+    interrupts();
+    if (current.adu[0] == 0) {
+      reply_end_ms = tx_done_ms;
+      finish(RS485_OK); // broadcast, no reply
+    } else {
+      const TimeoutLimits &limits =
+          current.limits ? *current.limits : RTU_TIMEOUTS;
+      reply_timeout_ms = deviceTimeoutMs(current.adu[0], limits);
+      state = BUS_WAIT_REPLY;
+    }
+  }
+  if (state == BUS_WAIT_REPLY) {
+    pollReply();
+    if (state == BUS_WAIT_REPLY)
+      return;
+  }
+
+  while (true) {
+    // Any byte on the line, stray ones included, restarts the silence.
+    if (!line_silent)
+      return;
+
+    QueueSlot *slot = nextSlot();
+    if (slot == nullptr)
+      return;
+    current = slot->req;
+    slot->used = false;
+
+    if ((int32_t)(millis() - current.deadline) > 0) {
+      rx_len = 0;
+      tx_done_ms = millis();
+      reply_end_ms = tx_done_ms;
+      finish(RS485_EXPIRED);
+      continue; // bus untouched, try the next request
+    }
+    startTransaction();
+    return;
+  }
+}
+
+void rs485PrepareRead(Rs485Request &req, uint8_t unit, uint16_t addr,
+                      uint16_t qty, Rs485Priority priority) {
+  req.adu[0] = unit;
+  req.adu[1] = 0x03;
+  req.adu[2] = addr >> 8;
+  req.adu[3] = addr;
+  req.adu[4] = qty >> 8;
+  req.adu[5] = qty;
+  req.len = 6;
+  req.priority = priority;
+  req.deadline = millis() + station_settings[SET_MONITOR_MS];
+  req.limits = nullptr;
+  req.done = nullptr;
+  req.ctx = nullptr;
+}
+
+void rs485PrepareWriteCoil(Rs485Request &req, uint8_t unit, uint16_t coil,
+                           bool on, Rs485Priority priority) {
+  req.adu[0] = unit;
+  req.adu[1] = 0x05;
+  req.adu[2] = coil >> 8;
+  req.adu[3] = coil;
+  req.adu[4] = on ? 0xFF : 0x00;
+  req.adu[5] = 0x00;
+  req.len = 6;
+  req.priority = priority;
+  req.deadline = millis() + station_settings[SET_MONITOR_MS];
+  req.limits = nullptr;
+  req.done = nullptr;
+  req.ctx = nullptr;
+}
+
+uint16_t rtuRegister(const uint8_t *resp, uint8_t index) {
+  const uint8_t *p = resp + 3 + index * 2;
+  return ((uint16_t)p[0] << 8) | p[1];
+}
+
+// Highest priority first, FIFO within one priority.
+static QueueSlot *nextSlot() {
+  QueueSlot *best = nullptr;
+  for (uint8_t i = 0; i < RS485_QUEUE_LEN; ++i) {
+    QueueSlot *s = &queue[i];
+    if (!s->used)
+      continue;
+    if (best == nullptr || s->req.priority < best->req.priority ||
+        (s->req.priority == best->req.priority &&
+         (int8_t)(s->seq - best->seq) < 0))
+      best = s;
+  }
+  return best;
+}
+
+// Opens the reply window and hands the ADU to the UDRE interrupt; the TX
+// complete interrupt releases the DIR pin.
+static void startTransaction() {
+  uint16_t crc = crc16_modbus(current.adu, current.len);
+  current.adu[current.len] = crc & 0xFF;
+  current.adu[current.len + 1] = crc >> 8;
+
+  noInterrupts();
+  rx_len = 0;
+  rx_crc = MODBUS_CRC_INIT;
+  rx_error = false;
+  frame_ready = false;
+  rx_open = current.adu[0] != 0;
+  tx_pos = 0;
+  tx_len = current.len + 2;
+  tx_busy = true;
+  interrupts();
+
+  dirTransmit(true);
+  UCSR3A |= (1 << TXC3); // clear a stale TX complete flag
+  UCSR3B |= (1 << UDRIE3);
+  state = BUS_SENDING;
+}
+
+static void pollReply() {
+  if (frame_ready) {
+    noInterrupts();
+    reply_end_ms = rx_end_ms;
+    interrupts();
+    frame_ready = false;
+
+    // CRC over data plus the received CRC leaves 0 on an intact frame;
+    // silence ends the frame, so the length must match the header.
+    uint8_t expected = replyLength(rx_buf, rx_len);
+    bool valid = !rx_error && rx_len >= 4 && rx_crc == 0 &&
+                 rx_buf[0] == current.adu[0] &&
+                 (rx_buf[1] & 0x7F) == current.adu[1] &&
+                 (expected == 0 || expected == rx_len);
+    if (!valid)
+      finish(RS485_BAD_FRAME);
+    else
+      finish((rx_buf[1] & 0x80) ? RS485_EXCEPTION : RS485_OK);
+    return;
+  }
+  // A reply that has started is normally closed by the silence timer; a
+  // device that never falls silent is cut off once even the longest
+  // reply would have been on the wire.
+  uint32_t waited = millis() - tx_done_ms;
+  if (waited <= reply_timeout_ms)
+    return;
+  bool babbling = waited > (uint32_t)reply_timeout_ms + MAX_RESP_WIRE_MS;
+  noInterrupts();
+  bool silent = rx_len == 0;
+  bool cut = babbling && !frame_ready; // the timer may just have closed it
+  if (silent || cut)
+    rx_open = false;
+  interrupts();
+  if (silent) {
+    reply_end_ms = millis();
+    finish(RS485_TIMEOUT);
+  } else if (cut) {
+    reply_end_ms = millis();
+    finish(RS485_BAD_FRAME);
+  }
+}
+
+static void finish(Rs485Status status) {
+  Rs485Result res;
+  res.status = status;
+  res.resp = rx_buf;
+  res.len = rx_len;
+  res.elapsedMs = reply_end_ms - tx_done_ms;
+
+  uint8_t unit = current.adu[0];
+  if (status == RS485_TIMEOUT)
+    deviceRecordTimeout(unit);
+  else if (status == RS485_OK || status == RS485_EXCEPTION)
+    deviceRecordRtt(unit, res.elapsedMs);
+
+  state = BUS_IDLE;
+  if (current.done)
+    current.done(current.ctx, res);
+}
+
+// Total reply length once the header tells it, 0 while still unknown.
+static uint8_t replyLength(const uint8_t *buf, uint8_t got) {
+  if (got < 2)
+    return 0;
+  if (buf[1] & 0x80)
+    return 5; // unit, func|0x80, code, CRC
+  switch (buf[1]) {
+  case 0x01:
+  case 0x02:
+  case 0x03:
+  case 0x04:
+    return (got >= 3) ? (uint8_t)(buf[2] + 5) : 0;
+  case 0x05:
+  case 0x06:
+  case 0x0F:
+  case 0x10:
+    return 8;
+  default:
+    return 0;
+  }
+}
+
+ISR(USART3_UDRE_vect) {
+  UDR3 = current.adu[tx_pos++];
+  if (tx_pos >= tx_len)
+    UCSR3B &= ~(1 << UDRIE3);
+}
+
+ISR(USART3_TX_vect) {
+  dirTransmit(false);
+  tx_end_ms = millis();
+  tx_busy = false;
+  restartSilenceTimer();
+}
+
+ISR(USART3_RX_vect) {
+  uint8_t status = UCSR3A;
+  uint8_t b = UDR3;
+  if (rx_open) {
+    if (status & ((1 << FE3) | (1 << DOR3) | (1 << UPE3)))
+      rx_error = true;
+    if (rx_len < sizeof(rx_buf)) {
+      rx_buf[rx_len] = b;
+      rx_len = rx_len + 1;
+      rx_crc = modbusCrcUpdate(rx_crc, b);
+    } else {
+      rx_error = true;
+    }
+  }
+  restartSilenceTimer();
+}
+
+ISR(TIMER1_COMPA_vect) {
+  TCCR1B = T35_STOPPED;
+  line_silent = true;
+  if (rx_open && rx_len > 0) {
+    rx_open = false;
+    rx_end_ms = millis();
+    frame_ready = true;
+  }
+}
@@ -0,0 +1,36 @@
+#include "sram_watch.h"
+#include "serial.h"
+
+extern char __heap_start;
+extern char *__brkval;
+
+constexpr uint8_t SRAM_PAINT = 0xA5;
+constexpr uint8_t SRAM_PAINT_GUARD = 32; // left alone below the caller
+
+static char *heapEnd() { return __brkval ? __brkval : &__heap_start; }
+
+void sramPaint() {
+  char here;
+  for (char *p = heapEnd(); p < &here - SRAM_PAINT_GUARD; ++p)
+    *p = SRAM_PAINT;
+}
+
+uint16_t sramFree() {
+  char here;
+  return &here - heapEnd();
+}
+
+uint16_t sramLowWater() {
+  char here;
+  const char *p = heapEnd();
+  while (p < &here && (uint8_t)*p == SRAM_PAINT)
+    ++p;
+  return p - heapEnd();
+}
+
+void sramLog() {
+  logLine("SRAM free: ", false);
+  logLine(sramFree(), false);
+  logLine(" B, low-water ", false);
+  logLine(sramLowWater(), true);
+}
@@ -1,20 +1,36 @@
 #include "config.h"
+#include "minute_log.h"
+#include "register_image.h"
+#include "rollup.h"
 #include "utils.h"
 #include "serial.h"
 
 static void rebuildSendArrayFromLabels();
 static void arrSumPeriodicUpdate();
 static void sendArrPeriodicUpdate();
+static void accumulate(uint8_t ch, int32_t x);
+static void closeMinute(uint8_t ch);
 
 static uint16_t tmp_id_value = 0;
 static uint16_t acc_count = 0;
 
-static float acc_sum[CH_COUNT] = {0};
-static float acc_sq_sum[CH_COUNT] = {0};
-static float channel_avg[CH_COUNT] = {0};
-static float channel_std[CH_COUNT] = {0};
+// Sums run over (x - shift), shift being the first sample of the minute:
+// they stay near zero however large the mean, so sumSq rarely needs more
+// than a 16x16 multiply and the variance does not cancel out.
+struct ChannelAccumulator {
+  uint8_t n; // fresh samples this minute
+  int32_t shift;
+  int32_t sum;
+  uint64_t sumSq;
+  int32_t min;
+  int32_t max;
+};
+
+static ChannelAccumulator acc[CH_COUNT] = {};
+static MinuteStats minute[CH_COUNT] = {};
+static AggregateInfo aggregate = {};
+static uint32_t sample_ms[CH_COUNT] = {0};
 
-static volatile bool g_rs485_busy = false;
 static _TimeGuardEntry _tg_entries[8];
 
 bool time_guard_allow(const char *key, uint32_t interval_ms,
@@ -43,22 +59,6 @@ bool time_guard_allow(const char *key, uint32_t interval_ms,
   return !wait_first;
 }
 
-bool rs485_acquire(uint16_t timeout_ms) {
-  uint32_t t0 = millis();
-  while (g_rs485_busy) {
-    if (millis() - t0 > timeout_ms)
-      return false;
-    delay(1);
-  }
-  g_rs485_busy = true;
-  return true;
-}
-
-void rs485_release() {
-  g_rs485_busy = false;
-  delayMicroseconds(4000);
-}
-
 size_t buildMbTcpRead03(uint8_t *out, uint16_t txId, uint8_t unit,
                         uint16_t addr, uint16_t qty) {
   out[0] = txId >> 8;
@@ -86,41 +86,27 @@ void printHex(const uint8_t *b, size_t n) {
   logLine();
 }
 
-// ================================ RS-485 DIR ================================
-void pre_transmission_main() { digitalWrite(RS485_DIR_PIN, HIGH); }
-void post_transmission_main() { digitalWrite(RS485_DIR_PIN, LOW); }
-
 void collectAndAverageEveryMinute() {
   // if (!time_guard_allow("sec-tick", 1000, true))
   //   return;
 
+  cycle_stale_channels = stale_channels;
   arrSumPeriodicUpdate();
   acc_count++;
   logLine("Acc_count: ", false);
   logLine(acc_count, true);
 
-  if (acc_count >= SAMPLES_PER_MIN) {
-    for (size_t index = 0; index < CH_COUNT; ++index) {
-      float sampleCount = (acc_count == 0) ? 1.0f : (float)acc_count;
-      float avg = acc_sum[index] / sampleCount; // середнє за хвилину
-      channel_avg[index] = avg;
-
-      float variance = 0.0f;
-      // Вибіркова дисперсія (acc_sq_sum - n*avg^2)/(n-1)
-      if (sampleCount > 1.0f) {
-        variance = (acc_sq_sum[index] - sampleCount * avg * avg) /
-                   (sampleCount - 1.0f);
-        // if (variance < 0.0f)
-        //   variance = 0.0f;
-      }
-      channel_std[index] = sqrtf(variance);
-
-      acc_sum[index] = 0;
-      acc_sq_sum[index] = 0; // готуємося до наступної хвилини
-    }
+  if (acc_count >= samplesPerMinute()) {
+    for (uint8_t index = 0; index < CH_COUNT; ++index)
+      closeMinute(index);
     acc_count = 0;
+    aggregate.seq++;
+    aggregate.computedMs = millis();
 
     rebuildSendArrayFromLabels();
+    registerImagePublish();
+    rollupAddMinute();
+    minuteLogAppend();
     logLine(F("--- 1-min averages ready ---"), true);
     sendArrPeriodicUpdate();
   }
@@ -139,9 +125,10 @@ static void rebuildSendArrayFromLabels() {
     if (idx < CH_COUNT) {
       if (channel == CH_R) {
         // Use the latest radiation value instead of minute average.
-        value = radiation_uSvh;
-      } else {
-        value = labels[i].useStd ? channel_std[idx] : channel_avg[idx];
+        value = fxToFloat(CH_R, channel_fx[CH_R]);
+      } else if (aggregate.samples[idx] != 0) {
+        value = fxToFloat(channel, labels[i].useStd ? minute[idx].std
+                                                    : minute[idx].mean);
       }
     }
     send_arr[i] = value;
@@ -149,23 +136,178 @@ static void rebuildSendArrayFromLabels() {
 }
 
 static void arrSumPeriodicUpdate() {
-  uint8_t i = 0;
-  for (int index = 0; index < sensors_dec_cnt; ++i, ++index) {
-    acc_sum[i] += sensors_dec[index];
-    acc_sq_sum[i] += sensors_dec[index] * sensors_dec[index];
+  for (uint8_t i = 0; i < CH_COUNT; ++i) {
+    // Radiation is sent live, not averaged; stale readings stay out of
+    // the minute statistics
+    if (i == CH_R || (stale_channels & chBit((ChannelIndex)i)))
+      continue;
+    accumulate(i, channel_fx[i]);
+  }
+}
+
+static void accumulate(uint8_t ch, int32_t x) {
+  ChannelAccumulator &a = acc[ch];
+  if (a.n == 0) {
+    a.shift = x;
+    a.min = x;
+    a.max = x;
+  } else if (x < a.min) {
+    a.min = x;
+  } else if (x > a.max) {
+    a.max = x;
   }
+  int32_t d = x - a.shift;
+  uint32_t ad = d < 0 ? -(uint32_t)d : (uint32_t)d;
+  a.sum += d;
+  if (ad <= 0xFFFF)
+    a.sumSq += (uint16_t)ad * (uint32_t)(uint16_t)ad;
+  else
+    a.sumSq += (uint64_t)ad * ad;
+  a.n++;
+}
 
-  // Radiation: do not accumulate, keep channel index aligned.
-  ++i;
-  // acc_sum[9] += radiation_uSvh;
-  // acc_sq_sum[9] += radiation_uSvh * radiation_uSvh;
-  for (int index = 0; index < service_t_cnt; ++i, ++index) {
-    acc_sum[i] += service_t[index];
-    acc_sq_sum[i] += service_t[index] * service_t[index];
+static void closeMinute(uint8_t ch) {
+  ChannelAccumulator &a = acc[ch];
+  MinuteStats &m = minute[ch];
+  aggregate.samples[ch] = a.n;
+  if (a.n == 0)
+    return; // no device delivered this channel during the minute
+  int32_t n = a.n;
+  int32_t half = a.sum < 0 ? -n / 2 : n / 2;
+  m.mean = a.shift + (a.sum + half) / n; // середнє за хвилину
+  m.std = 0;
+  // Вибіркова дисперсія (n*sumSq - sum^2) / (n*(n-1)) по зсунутих відліках
+  if (n > 1) {
+    int64_t num = (int64_t)(a.sumSq * n) - (int64_t)a.sum * a.sum;
+    if (num > 0)
+      m.std = isqrt64(((uint64_t)num + n * (n - 1) / 2) / (n * (n - 1)));
   }
+  m.min = a.min;
+  m.max = a.max;
+  a = ChannelAccumulator(); // готуємося до наступної хвилини
+}
+
+#ifdef FIXED_POINT_BENCH
+static int32_t benchDivider(ChannelIndex ch) {
+  return channelScale(ch) == 100    ? divider_t_rh
+         : channelScale(ch) == 1000 ? pm_divider
+                                    : so2_no2_divider;
+}
+
+void fixedPointBenchmark() {
+  uint8_t n = samplesPerMinute();
+  volatile float sink = 0; // keeps the results alive
+
+  // Float: raw / divider, float sums, mean and std through sqrt()
+  uint32_t t0 = micros();
+  float sum[CH_COUNT] = {0}, sumSq[CH_COUNT] = {0};
+  for (uint8_t s = 0; s < n; ++s)
+    for (uint8_t ch = 0; ch < CH_COUNT; ++ch) {
+      int32_t raw = 1234 + s * 7 + ch;
+      float v = raw / (float)benchDivider((ChannelIndex)ch);
+      sum[ch] += v;
+      sumSq[ch] += v * v;
+    }
+  for (uint8_t ch = 0; ch < CH_COUNT; ++ch) {
+    float mean = sum[ch] / n;
+    float var = (sumSq[ch] - n * mean * mean) / (n - 1);
+    sink = mean;
+    sink = var > 0 ? sqrt(var) : 0;
+  }
+  uint32_t t_float = micros() - t0;
+
+  // Fixed point: the code the per-second path runs
+  t0 = micros();
+  for (uint8_t s = 0; s < n; ++s)
+    for (uint8_t ch = 0; ch < CH_COUNT; ++ch)
+      accumulate(ch, fxFromRaw((ChannelIndex)ch, 1234 + s * 7 + ch,
+                               benchDivider((ChannelIndex)ch)));
+  for (uint8_t ch = 0; ch < CH_COUNT; ++ch) {
+    closeMinute(ch);
+    sink = fxToFloat((ChannelIndex)ch, minute[ch].mean);
+    sink = fxToFloat((ChannelIndex)ch, minute[ch].std);
+  }
+  uint32_t t_fixed = micros() - t0;
+  (void)sink;
+
+  memset(minute, 0, sizeof(minute));
+  memset(aggregate.samples, 0, sizeof(aggregate.samples));
+
+  logLine("FX bench samples=", false);
+  logLine((uint16_t)n * CH_COUNT, false);
+  logLine(" float us=", false);
+  logLine(t_float, false);
+  logLine(" fixed us=", false);
+  logLine(t_fixed, true);
+}
+#endif
+
+uint8_t samplesPerMinute() {
+  return MIN / station_settings[SET_MONITOR_MS];
+}
+
+uint32_t isqrt64(uint64_t v) {
+  uint64_t r = 0;
+  uint64_t bit = (uint64_t)1 << 62;
+  while (bit > v)
+    bit >>= 2;
+  while (bit != 0) {
+    if (v >= r + bit) {
+      v -= r + bit;
+      r = (r >> 1) + bit;
+    } else {
+      r >>= 1;
+    }
+    bit >>= 2;
+  }
+  return v > r ? r + 1 : r;
+}
+
+int32_t fxFromFloat(ChannelIndex ch, float v) {
+  float f = v * channelScale(ch);
+  if (!(f == f))
+    return 0;
+  if (f >= 2147483520.0f)
+    return INT32_MAX;
+  if (f <= -2147483520.0f)
+    return -INT32_MAX;
+  return (int32_t)(f < 0 ? f - 0.5f : f + 0.5f);
+}
+
+const AggregateInfo &aggregateInfo() { return aggregate; }
+
+const MinuteStats &minuteStats(ChannelIndex ch) { return minute[ch]; }
+
+float channelLiveValue(ChannelIndex ch) {
+  return ch < CH_COUNT ? fxToFloat(ch, channel_fx[ch]) : DEFAULT_SEND_VAL;
+}
+
+uint32_t channelSampleMs(ChannelIndex ch) {
+  return ch < CH_COUNT ? sample_ms[ch] : 0;
+}
+
+void markChannelsFresh(uint16_t mask) {
+  stale_channels &= ~mask;
+  uint32_t now = millis();
+  for (uint8_t ch = 0; ch < CH_COUNT; ++ch)
+    if (mask & chBit((ChannelIndex)ch))
+      sample_ms[ch] = now;
 }
 
 // ============================== send_arr Maintenance ========================
+void sendArrRefreshLive() {
+  bool changed = false;
+  float radiation = fxToFloat(CH_R, channel_fx[CH_R]);
+  for (size_t i = 0; i < labels_len && i < SEND_ARR_SIZE; ++i) {
+    if (labels[i].channel != CH_R || send_arr[i] == radiation)
+      continue;
+    send_arr[i] = radiation;
+    changed = true;
+  }
+  if (changed)
+    registerImagePublish();
+}
+
 static void sendArrPeriodicUpdate() {
   for (uint16_t id = 0; id < labels_len; id++) {
     logLine(labels[id].name, false);
@@ -0,0 +1,32 @@
+#pragma once
+// Host stand-in for the Arduino core, just enough for the modules built
+// by [env:native]. The clock only moves when a test advances it.
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define F(s) (s)
+#define HEX 16
+#define DEC 10
+#define bitRead(v, b) (((v) >> (b)) & 0x01)
+
+typedef uint8_t byte;
+
+inline uint32_t fake_millis = 0;
+inline unsigned long millis() { return fake_millis; }
+inline unsigned long micros() { return fake_millis * 1000UL; }
+
+// Output is dropped; the tests report through Unity.
+struct NullPrint {
+  template <typename T> size_t print(const T &, int = DEC) { return 0; }
+  template <typename T> size_t println(const T &, int = DEC) { return 0; }
+  size_t println() { return 0; }
+};
+
+inline NullPrint Serial;
@@ -0,0 +1,36 @@
+#pragma once
+#include <Arduino.h>
+
+// 4 KB of EEPROM that counts the writes each cell takes, for wear checks.
+struct EEPROMClass {
+  uint8_t mem[4096];
+  uint32_t writes[4096];
+
+  EEPROMClass() { erase(); }
+  void erase() {
+    memset(mem, 0xFF, sizeof(mem));
+    memset(writes, 0, sizeof(writes));
+  }
+  uint8_t read(int a) { return mem[a]; }
+  void write(int a, uint8_t v) {
+    mem[a] = v;
+    writes[a]++;
+  }
+  void update(int a, uint8_t v) {
+    if (mem[a] != v)
+      write(a, v);
+  }
+  uint16_t length() { return sizeof(mem); }
+  template <typename T> T &get(int a, T &t) {
+    memcpy(&t, mem + a, sizeof(T));
+    return t;
+  }
+  template <typename T> const T &put(int a, const T &t) {
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(&t);
+    for (size_t i = 0; i < sizeof(T); ++i)
+      update(a + i, p[i]);
+    return t;
+  }
+};
+
+inline EEPROMClass EEPROM;
@@ -0,0 +1,23 @@
+#pragma once
+#include <Arduino.h>
+
+class IPAddress {
+public:
+  IPAddress() : b{0, 0, 0, 0} {}
+  IPAddress(uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3)
+      : b{b0, b1, b2, b3} {}
+  uint8_t operator[](int i) const { return b[i]; }
+
+private:
+  uint8_t b[4];
+};
+
+// Never connected, so logLine() only reaches Serial.
+class EthernetClient : public NullPrint {
+public:
+  explicit operator bool() { return false; }
+  bool connected() { return false; }
+  void stop() {}
+};
+
+inline EthernetClient client; // serial.cpp's log client
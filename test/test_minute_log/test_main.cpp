@@ -0,0 +1,129 @@
+// Store-and-forward minute log over a simulated server outage, on the
+// write-counting EEPROM of test/stubs.
+#include "minute_log.h"
+#include "utils.h"
+#include <EEPROM.h>
+#include <unity.h>
+
+void registerImagePublish() {}
+
+static int16_t minute_no; // CO value of the next minute, in log units
+
+// One full minute whose CO average logs as minute_no (0.01 ppm steps).
+static void closeMinute() {
+  for (uint8_t s = 0; s < samplesPerMinute(); ++s) {
+    channel_fx[CH_CO] = (int32_t)minute_no * 100;
+    markChannelsFresh(chBit(CH_CO));
+    collectAndAverageEveryMinute();
+    fake_millis += station_settings[SET_MONITOR_MS];
+  }
+  minute_no++;
+}
+
+// Uploads the whole backlog; every record must be the next minute.
+static uint16_t drain(int16_t &expect) {
+  MinuteRecord rec;
+  uint16_t sent = 0;
+  while (minuteLogPeek(rec)) {
+    TEST_ASSERT_EQUAL_INT16(expect, rec.values[CH_CO]);
+    TEST_ASSERT_EQUAL_INT16(INT16_MIN, rec.values[CH_SO2]); // never sampled
+    expect++;
+    minuteLogMarkSent();
+    sent++;
+  }
+  return sent;
+}
+
+static uint16_t slotBytes() {
+  return (EEPROM_LOG_END - EEPROM_LOG_ADDR) / minuteLogCapacity();
+}
+
+void setUp() {
+  EEPROM.erase();
+  minuteLogInit();
+  minute_no = 0;
+}
+
+void tearDown() {}
+
+static void test_outage_up_to_capacity_loses_nothing() {
+  uint8_t cap = minuteLogCapacity();
+  TEST_ASSERT_EQUAL_UINT8(125, cap);
+  for (uint8_t m = 0; m < cap; ++m) {
+    if (m == 70)
+      minuteLogInit(); // reboot mid-outage: only EEPROM survives
+    closeMinute();
+  }
+  TEST_ASSERT_EQUAL_UINT16(cap, minuteLogPending());
+  TEST_ASSERT_EQUAL_UINT16(0, minuteLogOverwritten());
+
+  int16_t expect = 0;
+  TEST_ASSERT_EQUAL_UINT16(cap, drain(expect));
+  minuteLogInit(); // sent flags persist: nothing comes back
+  TEST_ASSERT_EQUAL_UINT16(0, minuteLogPending());
+}
+
+static void test_longer_outage_overwrites_oldest_and_counts() {
+  const uint16_t outage = 200;
+  for (uint16_t m = 0; m < outage; ++m)
+    closeMinute();
+  uint8_t cap = minuteLogCapacity();
+  TEST_ASSERT_EQUAL_UINT16(cap, minuteLogPending());
+  TEST_ASSERT_EQUAL_UINT16(outage - cap, minuteLogOverwritten());
+
+  int16_t expect = outage - cap; // the newest cap minutes survive
+  TEST_ASSERT_EQUAL_UINT16(cap, drain(expect));
+  TEST_ASSERT_EQUAL_INT16(outage, expect);
+}
+
+static void test_backlog_drains_while_minutes_keep_closing() {
+  int16_t expect = 0;
+  for (uint8_t m = 0; m < 90; ++m)
+    closeMinute();
+  // Server back: one record per minute closed until the backlog is gone
+  MinuteRecord rec;
+  for (uint8_t m = 0; m < 100; ++m) {
+    closeMinute();
+    for (uint8_t k = 0; k < 2 && minuteLogPeek(rec); ++k) {
+      TEST_ASSERT_EQUAL_INT16(expect++, rec.values[CH_CO]);
+      minuteLogMarkSent();
+    }
+  }
+  drain(expect);
+  TEST_ASSERT_EQUAL_INT16(minute_no, expect);
+}
+
+static void test_wear_is_spread_over_the_ring() {
+  uint8_t cap = minuteLogCapacity();
+  const uint8_t laps = 20;
+  int16_t expect = 0;
+  for (uint16_t m = 0; m < (uint16_t)laps * cap; ++m) {
+    closeMinute();
+    drain(expect);
+  }
+
+  for (int a = 0; a < EEPROM_LOG_ADDR; ++a)
+    TEST_ASSERT_EQUAL_UINT32(0, EEPROM.writes[a]);
+  // Each lap writes a slot once and flips its sent flag once
+  uint32_t most = 0, least = UINT32_MAX;
+  for (uint8_t s = 0; s < cap; ++s) {
+    int base = EEPROM_LOG_ADDR + s * slotBytes();
+    for (uint16_t b = 0; b < slotBytes(); ++b)
+      TEST_ASSERT_LESS_OR_EQUAL_UINT32(2u * laps, EEPROM.writes[base + b]);
+    if (EEPROM.writes[base] > most)
+      most = EEPROM.writes[base];
+    if (EEPROM.writes[base] < least)
+      least = EEPROM.writes[base];
+  }
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(2u * laps, most);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(1, most - least);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_outage_up_to_capacity_loses_nothing);
+  RUN_TEST(test_longer_outage_overwrites_oldest_and_counts);
+  RUN_TEST(test_backlog_drains_while_minutes_keep_closing);
+  RUN_TEST(test_wear_is_spread_over_the_ring);
+  return UNITY_END();
+}
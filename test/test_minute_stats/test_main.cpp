@@ -0,0 +1,140 @@
+// Minute statistics against a double-precision reference: the shifted-sum
+// accumulator in utils.cpp and isqrt64().
+#include "utils.h"
+#include <math.h>
+#include <unity.h>
+
+void registerImagePublish() {}
+
+struct Reference {
+  double mean;
+  double std;
+  int32_t min;
+  int32_t max;
+};
+
+static Reference reference(const int32_t *x, uint8_t n) {
+  Reference r = {0, 0, x[0], x[0]};
+  for (uint8_t i = 0; i < n; ++i) {
+    r.mean += x[i];
+    if (x[i] < r.min)
+      r.min = x[i];
+    if (x[i] > r.max)
+      r.max = x[i];
+  }
+  r.mean /= n;
+  double m2 = 0;
+  for (uint8_t i = 0; i < n; ++i)
+    m2 += (x[i] - r.mean) * (x[i] - r.mean);
+  r.std = n > 1 ? sqrt(m2 / (n - 1)) : 0;
+  return r;
+}
+
+// Feeds one full minute of x to ch alone and checks the closed statistics.
+static void checkMinute(ChannelIndex ch, const int32_t *x) {
+  uint8_t n = samplesPerMinute();
+  for (uint8_t i = 0; i < n; ++i) {
+    stale_channels = POLLED_CHANNELS & ~chBit(ch);
+    channel_fx[ch] = x[i];
+    collectAndAverageEveryMinute();
+  }
+  Reference r = reference(x, n);
+  const MinuteStats &m = minuteStats(ch);
+  TEST_ASSERT_EQUAL_UINT8(n, aggregateInfo().samples[ch]);
+  TEST_ASSERT_TRUE_MESSAGE(fabs(m.mean - r.mean) <= 0.5, "mean");
+  TEST_ASSERT_TRUE_MESSAGE(fabs(m.std - r.std) <= 1.0, "std");
+  TEST_ASSERT_EQUAL_INT32(r.min, m.min);
+  TEST_ASSERT_EQUAL_INT32(r.max, m.max);
+}
+
+static uint32_t lcg = 12345;
+static int32_t noise(int32_t span) {
+  lcg = lcg * 1103515245u + 12345u;
+  return (int32_t)((lcg >> 8) % (2u * span + 1)) - span;
+}
+
+static int32_t x[120];
+
+void setUp() {}
+void tearDown() {}
+
+static void test_isqrt64_rounds_to_nearest() {
+  const uint64_t fixed[] = {0,  1,  2,  3,  4,  8,  9,  15, 16, 17,
+                            0xFFFFFFFFull, 0x100000000ull,
+                            0xFFFFFFFE00000001ull, 0xFFFFFFFFFFFFFFFFull};
+  for (uint64_t v : fixed) {
+    long double ref = floorl(sqrtl((long double)v) + 0.5L);
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)ref, isqrt64(v));
+  }
+  // Either side of every rounding boundary r^2 + r
+  for (uint64_t r = 1; r < 0xFFFFFFFFull; r = r * 3 + 1) {
+    TEST_ASSERT_EQUAL_UINT32(r, isqrt64(r * r + r));
+    TEST_ASSERT_EQUAL_UINT32(r + 1, isqrt64(r * r + r + 1));
+    TEST_ASSERT_EQUAL_UINT32(r, isqrt64(r * r - r + 1));
+  }
+}
+
+static void test_large_offset_keeps_small_spread() {
+  // A few counts of noise on 1.5e9: a plain sum of squares would cancel
+  for (uint8_t i = 0; i < samplesPerMinute(); ++i)
+    x[i] = 1500000000 + noise(40);
+  checkMinute(CH_CO, x);
+  for (uint8_t i = 0; i < samplesPerMinute(); ++i)
+    x[i] = -2000000000 + noise(3);
+  checkMinute(CH_S_T, x);
+}
+
+static void test_constant_minute_has_zero_std() {
+  const int32_t levels[] = {0, 7, -123456, 2147000000};
+  for (int32_t c : levels) {
+    for (uint8_t i = 0; i < samplesPerMinute(); ++i)
+      x[i] = c;
+    checkMinute(CH_SO2, x);
+    TEST_ASSERT_EQUAL_INT32(c, minuteStats(CH_SO2).mean);
+    TEST_ASSERT_EQUAL_INT32(0, minuteStats(CH_SO2).std);
+  }
+}
+
+static void test_min_max_anywhere_in_the_minute() {
+  uint8_t n = samplesPerMinute();
+  // Extremes first, last and in the middle, on both sides of the shift
+  for (uint8_t i = 0; i < n; ++i)
+    x[i] = 500000 + noise(20000);
+  x[0] = -3000000;
+  x[n - 1] = 4000000;
+  checkMinute(CH_PM10, x);
+  for (uint8_t i = 0; i < n; ++i)
+    x[i] = noise(10000000);
+  x[n / 2] = -10000001;
+  x[n / 3] = 10000001;
+  checkMinute(CH_NO2, x);
+}
+
+static void test_wide_random_spread() {
+  for (uint8_t rep = 0; rep < 20; ++rep) {
+    int32_t base = noise(1000000000);
+    for (uint8_t i = 0; i < samplesPerMinute(); ++i)
+      x[i] = base + noise(5000000);
+    checkMinute(CH_NO, x);
+  }
+}
+
+static void test_minute_follows_polling_period() {
+  station_settings[SET_MONITOR_MS] = 500;
+  TEST_ASSERT_EQUAL_UINT8(120, samplesPerMinute());
+  for (uint8_t i = 0; i < samplesPerMinute(); ++i)
+    x[i] = 250000 + noise(9000);
+  checkMinute(CH_H2S, x);
+  station_settings[SET_MONITOR_MS] = MONITOR_TIME_SLEEP;
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_isqrt64_rounds_to_nearest);
+  RUN_TEST(test_large_offset_keeps_small_spread);
+  RUN_TEST(test_constant_minute_has_zero_std);
+  RUN_TEST(test_min_max_anywhere_in_the_minute);
+  RUN_TEST(test_wide_random_spread);
+  RUN_TEST(test_minute_follows_polling_period);
+  return UNITY_END();
+}